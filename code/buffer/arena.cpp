@@ -0,0 +1,63 @@
+#include "arena.h"
+
+Arena::Arena(size_t blockSize, pmr::memory_resource* mem) : mem_(mem), blockSize_(blockSize), cur_(0), offset_(0)
+{
+    assert(blockSize > 0);
+}
+
+Arena::~Arena()
+{
+    for(auto& block : blocks_)
+    {
+        if(mem_)
+            mem_->deallocate(block.data, block.size);
+        else
+            free(block.data);
+    }
+}
+
+// 当前块放不下时依次尝试后面保留下来的块，都放不下才向系统申请新块；块内的起点同样按align对齐
+void* Arena::AllocateSlow_(size_t len, size_t align)
+{
+    size_t next = blocks_.empty() ? 0 : cur_ + 1;
+    for(; next < blocks_.size(); next++)
+    {
+        if(AlignedStart_(blocks_[next].data, align) + len <= blocks_[next].size)
+            break;
+    }
+    if(next == blocks_.size())
+    {
+        size_t size = len + align - 1 > blockSize_ ? len + align - 1 : blockSize_;
+        char* data = static_cast<char*>(mem_ ? mem_->allocate(size) : malloc(size));
+        if(!data)
+            throw bad_alloc();
+        blocks_.push_back({data, size});
+    }
+    cur_ = next;
+    size_t start = AlignedStart_(blocks_[cur_].data, align);
+    offset_ = start + len;
+    return blocks_[cur_].data + start;
+}
+
+string_view Arena::Copy(string_view str)
+{
+    char* data = static_cast<char*>(Allocate(str.size() + 1, 1));
+    memcpy(data, str.data(), str.size());
+    data[str.size()] = '\0';
+    return string_view(data, str.size());
+}
+
+string_view Arena::Concat(string_view a, string_view b)
+{
+    char* data = static_cast<char*>(Allocate(a.size() + b.size() + 1, 1));
+    memcpy(data, a.data(), a.size());
+    memcpy(data + a.size(), b.data(), b.size());
+    data[a.size() + b.size()] = '\0';
+    return string_view(data, a.size() + b.size());
+}
+
+void Arena::Reset()
+{
+    cur_ = 0;
+    offset_ = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <new>
+
+using namespace std;
+
+// 请求级的bump分配器：只向前分配，不单独释放，请求结束时Reset()一次性回收
+// 内存块在Reset()后保留复用，稳态下不再调用malloc；不是线程安全的
+// mem不为空时内存块从mem分配(如reactor所在节点的内存池)，否则用malloc
+class Arena
+{
+public:
+    static const size_t DEFAULT_BLOCK = 2048;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK, pmr::memory_resource* mem = nullptr);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t len, size_t align = alignof(max_align_t));
+    string_view Copy(string_view str);                      // 复制一份，末尾补'\0'
+    string_view Concat(string_view a, string_view b);       // 拼接，末尾补'\0'
+    void Reset();                                           // O(1)，回到第一块的开头
+
+    size_t BlockCount() const { return blocks_.size(); }
+
+private:
+    void* AllocateSlow_(size_t len, size_t align);
+    // data之后第一个按align对齐的位置相对data的偏移
+    static size_t AlignedStart_(const char* data, size_t align) { return -reinterpret_cast<uintptr_t>(data) & (align - 1); }
+
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    vector<Block> blocks_;
+    pmr::memory_resource* mem_;
+    size_t blockSize_;
+    size_t cur_;                                            // 当前分配的块
+    size_t offset_;                                         // 当前块已用的字节数
+};
+
+inline void* Arena::Allocate(size_t len, size_t align)
+{
+    assert(align > 0 && (align & (align - 1)) == 0 && align <= alignof(max_align_t));
+    if(cur_ < blocks_.size())
+    {
+        size_t start = (offset_ + align - 1) & ~(align - 1);
+        if(start + len <= blocks_[cur_].size)
+        {
+            offset_ = start + len;
+            return blocks_[cur_].data + start;
+        }
+    }
+    return AllocateSlow_(len, align);
+}
+
+#endif
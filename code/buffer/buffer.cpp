@@ -1,7 +1,8 @@
 #include "buffer.h"
 
 // 读写下标初始化，vector<char> 初始化
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+Buffer::Buffer(int initBuffSize, pmr::memory_resource* mem) :
+    buffer_(initBuffSize, mem ? mem : pmr::get_default_resource()), readPos_(0), writePos_(0) {}
 
 // 可写的数量：buffer大小 —— 写下标
 size_t Buffer::WritableBytes() const
@@ -53,6 +54,15 @@ void Buffer::RetrieveUntil(const char* end)
     Retrieve(end - Peek()); // end指针 - 读指针 长度
 }
 
+// 删掉可读区域中[offset, offset + len)的数据，后面的数据前移，流式处理请求体时丢掉已经消费的字节
+void Buffer::Erase(size_t offset, size_t len)
+{
+    assert(offset + len <= ReadableBytes());
+    char* begin = BeginPtr_() + readPos_ + offset;
+    memmove(begin, begin + len, ReadableBytes() - offset - len);
+    writePos_ -= len;
+}
+
 // 取出所有数据，buffer归零，都写下标归零，在别的函数中会用到
 void Buffer::RetrieveAll()
 {
@@ -80,9 +90,11 @@ char* Buffer::BeginWrite()
     return &buffer_[writePos_];
 }
 
-void Buffer::Append(const string& str)
+void Buffer::Append(string_view str)
 {
-    Append(str.c_str(), str.size());
+    if(str.empty())
+        return;
+    Append(str.data(), str.size());
 }
 
 // 添加str到缓冲区
@@ -5,6 +5,8 @@
 #include <unistd.h>      // write
 #include <sys/uio.h>     // readv
 #include <vector>        // readv
+#include <memory_resource>
+#include <string_view>
 #include <atomic>
 #include <assert.h>
 
@@ -13,7 +15,8 @@ using namespace std;
 class Buffer 
 {
 public:
-    Buffer(int initBuffSize = 1024);
+    // mem为空时使用默认的operator new
+    Buffer(int initBuffSize = 1024, pmr::memory_resource* mem = nullptr);
     ~Buffer() = default;
 
     size_t WritableBytes() const;
@@ -26,6 +29,7 @@ public:
 
     void Retrieve(size_t len);
     void RetrieveUntil(const char* end);
+    void Erase(size_t offset, size_t len);
 
     void RetrieveAll();
     string RetrieveAllToStr();
@@ -33,7 +37,7 @@ public:
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
-    void Append(const string& str);
+    void Append(string_view str);           // 字面量直接转成string_view，不构造临时string
     void Append(const char* str,size_t len);
     void Append(const void* data,size_t len);
     void Append(const Buffer& buff);
@@ -46,7 +50,7 @@ private:
     const char* BeginPtr_() const;
     void MakeSpace_(size_t len);
 
-    vector<char> buffer_;
+    pmr::vector<char> buffer_;
     atomic<size_t> readPos_;     // 读操作下标
     atomic<size_t> writePos_;    // 写操作下标
 };
@@ -0,0 +1,32 @@
+#include "noderesource.h"
+
+// 映射按页对齐；pmr池会按块大小要求更大的对齐，这时多映射align字节，再把两头多出的页解除映射
+void* NodeResource::do_allocate(size_t bytes, size_t align)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (bytes + page - 1) & ~(page - 1);
+    size_t extra = align > page ? align : 0;
+    void* addr = mmap(nullptr, len + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+        throw bad_alloc();
+    char* base = static_cast<char*>(addr);
+    if(extra)
+    {
+        char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + align - 1) & ~(align - 1));
+        if(aligned > base)
+            munmap(base, aligned - base);
+        if(base + extra > aligned)
+            munmap(aligned + len, base + extra - aligned);
+        base = aligned;
+    }
+    if(node_ >= 0)
+        Affinity::BindMemory(base, len, node_);
+    return base;
+}
+
+// 分配时两头多映射的部分已经解除，剩下的正好是按页取整的bytes，不需要align
+void NodeResource::do_deallocate(void* p, size_t bytes, size_t)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    munmap(p, (bytes + page - 1) & ~(page - 1));
+}
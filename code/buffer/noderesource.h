@@ -0,0 +1,30 @@
+#ifndef NODE_RESOURCE_H
+#define NODE_RESOURCE_H
+
+#include <sys/mman.h>
+#include <memory_resource>
+#include <new>
+
+#include "../pool/affinity.h"
+
+using namespace std;
+
+// 从匿名映射分配内存的memory_resource，SetNode后新映射在访问前先mbind到该节点
+// 每次分配一个映射，只适合作为pmr池的上游，由池切成小块；线程安全
+class NodeResource : public pmr::memory_resource
+{
+public:
+    explicit NodeResource(int node = -1) : node_(node) {}
+
+    void SetNode(int node) { node_ = node; }        // 只影响之后的分配
+    int Node() const { return node_; }
+
+private:
+    void* do_allocate(size_t bytes, size_t align) override;
+    void do_deallocate(void* p, size_t bytes, size_t align) override;
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    int node_;
+};
+
+#endif
@@ -6,11 +6,14 @@ const char* HttpConn::srcDir;
 atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
 
-HttpConn::HttpConn()
+HttpConn::HttpConn(pmr::memory_resource* mem) :
+    readBuff_(1024, mem), writeBuff_(1024, mem), stash_(1024, mem), request_(mem)
 {
     fd_ = -1;
     addr_ = {0};
     isClose_ = true;
+    iovIdx_ = toWrite_ = 0;
+    asyncStarted_ = resume_ = false;
 }
 
 HttpConn::~HttpConn()
@@ -26,6 +29,11 @@ void HttpConn::init(int fd, const sockaddr_in& addr)
     fd_ = fd;
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    stash_.RetrieveAll();
+    iov_.clear();
+    iovIdx_ = toWrite_ = 0;
+    request_.Init();
+    asyncStarted_ = resume_ = false;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
@@ -33,12 +41,14 @@ void HttpConn::init(int fd, const sockaddr_in& addr)
 void HttpConn::Close()
 {
     response_.UnmapFile();
+    UnmapFiles_();
+    request_.Init();                                    // 关闭请求体的临时文件
     if(isClose_ == false)
     {
         isClose_ = true;
         userCount--;
-        close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        close(fd_);     // 放在最后：fd关闭后可能立刻被其他reactor复用
     }
 }
 
@@ -47,30 +57,48 @@ int HttpConn::GetFd() const
     return fd_;
 }
 
+// 只在打日志等需要时才多一次系统调用
+void HttpConn::FetchAddr_() const
+{
+    if(addr_.sin_family != AF_UNSPEC)
+        return;
+    socklen_t len = sizeof(addr_);
+    if(getpeername(fd_, (struct sockaddr*)&addr_, &len) < 0)
+        addr_.sin_family = AF_UNSPEC;
+}
+
 struct sockaddr_in HttpConn::GetAddr() const
 {
+    FetchAddr_();
     return addr_;
 }
 
 const char* HttpConn::GetIP() const
 {
+    FetchAddr_();
     return inet_ntoa(addr_.sin_addr);
 }
 
 int HttpConn::GetPort() const
 {
+    FetchAddr_();
     return addr_.sin_port;
 }
 
+// ET模式下读缓冲攒到READ_WINDOW就先停下交给process()消费，重新注册EPOLLIN时还有数据会再次触发
 ssize_t HttpConn::read(int* saveErrno)
 {
     ssize_t len = -1;
     do 
     {
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        // 请求头之后的数据都已转存时，大请求体的剩余部分直接splice到临时文件
+        if(request_.CanSplice() && readBuff_.ReadableBytes() == request_.Length())
+            len = request_.SpliceBody(fd_, saveErrno);
+        else
+            len = readBuff_.ReadFd(fd_, saveErrno);
         if(len <= 0)
             break;
-    } while (isET);        // ET边沿触发要一次性全部读出
+    } while (isET && readBuff_.ReadableBytes() < READ_WINDOW);        // ET边沿触发要读到EAGAIN为止
     return len;
 }
 
@@ -79,60 +107,169 @@ ssize_t HttpConn::write(int* saveErrno)
     ssize_t len = -1;
     do
     {
-        len = writev(fd_, iov_, iovCnt_);   // 将iov的内容写到fd中
+        len = writev(fd_, GetIov(), GetIovCnt());   // 将iov的内容写到fd中
         if(len <= 0)
         {
             *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len == 0) 
+        Advance(len);
+        if(ToWriteBytes() == 0) 
             break;
-        else if(static_cast<size_t>(len) > iov_[0].iov_len)
-        {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len)
-            {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }
-        else
-        {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;
-            iov_[0].iov_len -= len;
-            writeBuff_.Retrieve(len);
-        }
     }   while(isET || ToWriteBytes() > 10240);
     return len;
 }
 
+void HttpConn::Advance(size_t len)
+{
+    toWrite_ -= len;
+    while(len > 0 && iovIdx_ < iov_.size())
+    {
+        struct iovec& iov = iov_[iovIdx_];
+        if(len < iov.iov_len)
+        {
+            iov.iov_base = (uint8_t*)iov.iov_base + len;
+            iov.iov_len -= len;
+            break;
+        }
+        len -= iov.iov_len;
+        iov.iov_len = 0;
+        iovIdx_++;
+    }
+}
+
+// 等待异步处理期间请求引用着读缓冲，新数据先放到stash_，避免读缓冲扩容
+void HttpConn::AppendRead(const char* data, size_t len)
+{
+    if(request_.AsyncPending())
+        stash_.Append(data, len);
+    else
+        readBuff_.Append(data, len);
+}
+
+void HttpConn::StartAsync(AsyncSqlPool* sql, Router::AsyncDone done)
+{
+    assert(NeedAsync());
+    asyncStarted_ = true;
+    request_.StartAsync(sql, move(done));
+}
+
+void HttpConn::FinishAsync(string_view path)
+{
+    request_.FinishAsync(path);
+    asyncStarted_ = false;
+    resume_ = true;
+}
+
+void HttpConn::StartBlocking()
+{
+    assert(NeedAsync());
+    asyncStarted_ = true;
+}
+
+void HttpConn::RunBlocking()
+{
+    blockingPath_ = request_.RunBlocking();
+}
+
+void HttpConn::FinishBlocking()
+{
+    FinishAsync(blockingPath_);
+}
+
+bool HttpConn::IsAsync() const
+{
+    return HttpRequest::IsAsync(readBuff_.Peek(), readBuff_.BeginWriteConst());
+}
+
+// 响应头紧挨着上一段响应头时合并成一个iov
+void HttpConn::AddIov_(char* base, size_t len)
+{
+    if(len == 0)
+        return;
+    if(!base && !iov_.empty() && !iov_.back().iov_base)
+        iov_.back().iov_len += len;
+    else
+        iov_.push_back({base, len});
+    toWrite_ += len;
+}
+
+void HttpConn::UnmapFiles_()
+{
+    for(auto& file : files_)
+        munmap(file.iov_base, file.iov_len);
+    files_.clear();
+}
+
+// 返回false表示没有完整的请求，解析状态保留在request_中，读到更多数据后继续
+// 只在上一批响应写完后调用
 bool HttpConn::process()
 {
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0)
+    if(request_.AsyncPending())                 // 还在等异步处理，读缓冲和上一批的响应都不能动
         return false;
-    else if(request_.parse(readBuff_))      //  解析成功
+    UnmapFiles_();
+    iov_.clear();
+    iovIdx_ = toWrite_ = 0;
+    writeBuff_.RetrieveAll();
+
+    int count = 0;
+    while(count < MAX_PIPELINE && readBuff_.ReadableBytes() > 0)
     {
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        // 要查数据库的请求留到下一批，由调用者决定是否交给线程池或发起异步查询
+        if(count > 0 && (MayBlock() || IsAsync()))
+            break;
+        // 异步处理完成后重新进来的请求已经解析过
+        HttpRequest::PARSE_RESULT ret = resume_ ? HttpRequest::PARSE_OK : request_.parse(readBuff_);
+        bool resumed = resume_;
+        resume_ = false;
+        if(ret == HttpRequest::PARSE_AGAIN)
+            break;
+        if(ret == HttpRequest::PARSE_OK && request_.AsyncPending())
+            break;                              // 由调用者StartAsync，本批只有这一个请求
+        if(ret == HttpRequest::PARSE_OK)        //  解析成功
+        {
+            LOG_DEBUG("%.*s", (int)request_.path().size(), request_.path().data());
+            response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+            readBuff_.Retrieve(request_.Length());  // 后面的数据属于下一个请求
+        }
+        else
+        {
+            response_.Init(srcDir, request_.path(), false, 400);
+            readBuff_.RetrieveAll();            // 出错后连接会关闭，剩下的数据不再处理
+        }
+
+        size_t headerLen = writeBuff_.ReadableBytes();
+        response_.MakeResponse(writeBuff_);     // 生成响应报文追加到writeBuff_中
+        AddIov_(nullptr, writeBuff_.ReadableBytes() - headerLen);
+        if(response_.FileLen() > 0 && response_.File())
+        {
+            size_t fileLen = response_.FileLen();
+            char* file = response_.ReleaseFile();
+            AddIov_(file, fileLen);
+            files_.push_back({file, fileLen});
+        }
+        count++;
+        if(resumed && stash_.ReadableBytes() > 0)
+        {
+            readBuff_.Append(stash_);
+            stash_.RetrieveAll();
+        }
+        if(!response_.IsKeepAlive())            // 连接要关闭，后面的请求不再处理
+            break;
     }
-    else
-        response_.Init(srcDir, request_.path(), false, 400);
-    
-    response_.MakeResponse(writeBuff_);  // 生成响应报文放入writeBuff_中
-    // 响应头
-    iov_[0].iov_base = const_cast<char*> (writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    // 文件
-    if(response_.FileLen() > 0 && response_.File())
+    if(count == 0)
+        return false;
+
+    // writeBuff_在生成过程中可能扩容，最后再填响应头的地址
+    char* header = const_cast<char*>(writeBuff_.Peek());
+    for(auto& iov : iov_)
     {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+        if(!iov.iov_base)
+        {
+            iov.iov_base = header;
+            header += iov.iov_len;
+        }
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen(), iovCnt_, ToWriteBytes());
+    LOG_DEBUG("%d responses, %d iovs, to write %d", count, (int)iov_.size(), ToWriteBytes());
     return true;
-}
\ No newline at end of file
+}
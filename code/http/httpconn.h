@@ -6,6 +6,8 @@
 #include <arpa/inet.h>          // sockaddr_in
 #include <stdlib.h>             // atoi()
 #include <error.h>              
+#include <limits.h>             // IOV_MAX
+#include <vector>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
@@ -17,9 +19,11 @@
 class HttpConn
 {
 public:
-    HttpConn();
+    // 读写缓冲和请求的arena从mem分配，为空时用默认的分配方式
+    explicit HttpConn(pmr::memory_resource* mem = nullptr);
     ~HttpConn();
 
+    // addr的sin_family为AF_UNSPEC时(io_uring的accept不带地址)，第一次用到对端地址时再getpeername
     void init(int sockFd, const sockaddr_in& addr);
     ssize_t read(int* saveErrno);
     ssize_t write(int* saveErrno);
@@ -28,34 +32,91 @@ public:
     int GetPort() const;
     const char* GetIP() const;
     sockaddr_in GetAddr() const;
-    bool process();
+    bool process();                                     // 处理读缓冲里所有完整的请求(流水线)，响应一次聚集写出
+
+    void AppendRead(const char* data, size_t len);      // 写入已经读到的数据(io_uring)
+    void Advance(size_t len);                           // 已写出len字节，调整iov
+    const struct iovec* GetIov() const { return iov_.data() + iovIdx_; }
+    int GetIovCnt() const { return min(iov_.size() - iovIdx_, (size_t)IOV_MAX); }
     
-    // 写的总长度
+    // 还没写出的总长度
     int ToWriteBytes()
     {
-        return iov_[0].iov_len + iov_[1].iov_len;
+        return toWrite_;
     }
 
+    // 以已生成的响应为准，解析出错时请求头里的keep-alive不算数
     bool IsKeepAlive() const
     {
-        return request_.IsKeepAlive();
+        return response_.IsKeepAlive();
+    }
+
+    bool IsClose() const
+    {
+        return isClose_;
+    }
+
+    // 读缓冲和stash_中还没处理的数据
+    size_t BufferedBytes() const
+    {
+        return readBuff_.ReadableBytes() + stash_.ReadableBytes();
+    }
+
+    bool MayBlock() const
+    {
+        return HttpRequest::MayBlock(readBuff_.Peek(), readBuff_.BeginWriteConst());
     }
 
+    // process()返回false且NeedAsync()时，请求在等待异步处理函数：调用者在reactor线程中StartAsync，
+    // 完成回调里FinishAsync后再调用process()生成响应
+    bool NeedAsync() const
+    {
+        return request_.AsyncPending() && !asyncStarted_;
+    }
+    void StartAsync(AsyncSqlPool* sql, Router::AsyncDone done);
+    void FinishAsync(string_view path);
+    bool HasAsyncHandler() const { return request_.HasAsyncHandler(); }
+
+    // 不发起异步处理，改调阻塞的处理函数：StartBlocking在reactor线程标记已开始，RunBlocking可以在工作线程执行，
+    // 只读请求、不碰缓冲区；FinishBlocking把结果交给请求，之后同FinishAsync
+    void StartBlocking();
+    void RunBlocking();
+    void FinishBlocking();
+
+    // io_uring下会阻塞的请求也停在等待状态，由reactor把RunBlocking交给线程池，期间收到的数据放进stash_
+    void DeferBlocking(bool on) { request_.DeferBlocking(on); }
+
     static bool isET;
     static const char* srcDir;
     static atomic<int> userCount;    // 原子变量
+    static const int MAX_PIPELINE = 32;                 // 一批最多处理的请求数
+    static const size_t READ_WINDOW = 256 * 1024;       // 一次read()最多攒在读缓冲里的数据
     
 private: 
     int fd_;
-    struct sockaddr_in addr_;
+    mutable struct sockaddr_in addr_;
+
+    void FetchAddr_() const;
 
     bool isClose_;
 
-    int iovCnt_;
-    struct iovec iov_[2];
+    bool IsAsync() const;
+    void AddIov_(char* base, size_t len);
+    void UnmapFiles_();
+
+    // 响应头在writeBuff_中(生成期间iov_base为空，全部生成后再填地址)，文件为mmap的内存
+    vector<struct iovec> iov_;
+    size_t iovIdx_;                                     // 第一个没写完的iov
+    size_t toWrite_;
+    vector<struct iovec> files_;                        // 本批响应映射的文件，写完后解除映射
 
     Buffer readBuff_;
     Buffer writeBuff_;
+    Buffer stash_;                                      // io_uring: 等待异步处理期间收到的数据
+
+    bool asyncStarted_;
+    bool resume_;                                       // 下次process()直接用已完成异步处理的请求
+    string_view blockingPath_;                          // RunBlocking的结果
 
     HttpRequest request_;
     HttpResponse response_;
@@ -1,293 +1,905 @@
 #include "httprequest.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML
+void HttpRequest::AddDefaultRoutes(Router* router)
 {
-    "/index","/register","/login",
-    "welcome","/video","/picture",
-};
+    router->AddRewrite("*", "/", "/index.html");
+    const char* pages[] = {"/index", "/register", "/login", "/welcome", "/video", "/picture"};
+    for(const char* page : pages)
+        router->AddRewrite("*", page, string(page) + ".html");
+    // 不是表单的POST按原页面返回
+    router->AddDynamic("POST", "/login", Login_, true, "/login.html", LoginAsync_);
+    router->AddDynamic("POST", "/login.html", Login_, true, string_view(), LoginAsync_);
+    router->AddDynamic("POST", "/register", Register_, true, "/register.html", RegisterAsync_);
+    router->AddDynamic("POST", "/register.html", Register_, true, string_view(), RegisterAsync_);
+}
+
+const bool HttpRequest::DEFAULT_ROUTES_ADDED = (AddDefaultRoutes(Router::Instance()), true);
 
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG
+// 常用请求头的小写名字，下标与HEADER_ID对应
+static constexpr string_view KNOWN_HEADERS[HttpRequest::HDR_KNOWN_COUNT] =
 {
-    {"/register.html", 0}, {"/login.html", 1},
+    "connection", "content-length", "content-type", "host",
+    "accept-encoding", "if-none-match", "range", "transfer-encoding",
 };
 
+// 哈希只看长度和首字母(转小写)，对上面几个名字无冲突，由static_assert在编译期检查
+static constexpr size_t HEADER_TABLE_SIZE = 16;
+
+static constexpr size_t HeaderHash(string_view name)
+{
+    return (name.size() + (name[0] | 0x20)) & (HEADER_TABLE_SIZE - 1);
+}
+
+static constexpr array<int8_t, HEADER_TABLE_SIZE> BuildHeaderTable()
+{
+    array<int8_t, HEADER_TABLE_SIZE> table{};
+    for(size_t i = 0; i < HEADER_TABLE_SIZE; i++)
+        table[i] = -1;
+    for(int id = 0; id < HttpRequest::HDR_KNOWN_COUNT; id++)
+    {
+        if(table[HeaderHash(KNOWN_HEADERS[id])] >= 0)
+            return array<int8_t, HEADER_TABLE_SIZE>{};      // 有冲突，全0的表过不了下面的检查
+        table[HeaderHash(KNOWN_HEADERS[id])] = id;
+    }
+    return table;
+}
+
+static constexpr array<int8_t, HEADER_TABLE_SIZE> HEADER_TABLE = BuildHeaderTable();
+static_assert(HEADER_TABLE[HeaderHash("range")] == HttpRequest::HDR_RANGE, "header hash is not perfect");
+
+const char* HttpRequest::spoolDir = "/tmp";
+bool HttpRequest::asyncDb = false;
+bool HttpRequest::singleFlight = true;
+
 void HttpRequest::Init()
 {
-    method_ = path_ = version_ = body_ = "";
+    post_ = nullptr;                    // 在arena中，随arena一起回收
+    postCount_ = 0;
+    arena_.Reset();
+    method_ = path_ = version_ = body_ = string_view();
+    route_ = nullptr;
+    asyncPending_ = false;
+    CloseBody_();
     state_ = REQUEST_LINE;
-    header_.clear();
-    post_.clear();
+    pos_ = scan_ = contentLen_ = 0;
+    bodyOff_ = bodyLen_ = chunkLeft_ = 0;
+    base_ = nullptr;
+    memset(known_, 0, sizeof(known_));
+    headers_.clear();
 }
 
-// 解析处理
-bool HttpRequest::parse(Buffer& buff)
+// 从scan开始找'\n'并确认前一个字节是'\r'，lineBegin之前的字节不算；没找到返回end
+const char* HttpRequest::FindCRLF_(const char* lineBegin, const char* scan, const char* end)
 {
-    const char CRLF[] = "\r\n";
-    if(buff.ReadableBytes() <= 0)  // 还没有可读的字节
-        return false;
-    
-    // 读取数据
-    while(buff.ReadableBytes() && state_ != FINISH)
-    {
-        // 开始从buff中的读指针开始到读指针结束，这块区域是未读取的数据的去处"\r\n", 返回有效数据的末行指针
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // 转化为string类型
-        string line(buff.Peek(), lineEnd);
+    while(scan < end)
+    {
+        const char* lf = static_cast<const char*>(memchr(scan, '\n', end - scan));
+        if(!lf)
+            break;
+        if(lf > lineBegin && lf[-1] == '\r')
+            return lf - 1;
+        scan = lf + 1;
+    }
+    return end;
+}
+
+// 增量解析：pos_是下一行在buff中相对Peek()的偏移，scan_是已经找过换行的位置，
+// 数据不完整时保存状态返回PARSE_AGAIN，下次从断点继续，已扫描过的字节不再扫描
+// 请求完整之前不从buff中取走数据，由调用者在处理完后取走Length()字节；
+// 例外是分块格式和转存到文件的请求体，处理后直接从buff中删掉
+HttpRequest::PARSE_RESULT HttpRequest::parse(Buffer& buff)
+{
+    if(state_ == FINISH)                // 上一个请求已处理完，开始新的请求
+        Init();
+    const char* begin = buff.Peek();
+    base_ = begin;
+    while(state_ != FINISH)
+    {
+        const char* end = buff.BeginWriteConst();   // 删掉请求体数据后末尾会前移
+        if(state_ == BODY || state_ == CHUNK_DATA)
+        {
+            PARSE_RESULT ret = ParseBody_(buff);
+            if(ret != PARSE_OK)
+                return ret;
+            continue;
+        }
+
+        const char* lineEnd = FindCRLF_(begin + pos_, begin + scan_, end);
+        if(lineEnd == end)
+        {
+            scan_ = end - begin;
+            // 请求头整体限长，分块格式的每一行单独限长
+            if(scan_ - (state_ > HEADERS ? pos_ : 0) > MAX_HEADER_SIZE)
+            {
+                LOG_ERROR("Header too large");
+                return PARSE_ERROR;
+            }
+            return PARSE_AGAIN;
+        }
+        size_t lineOff = pos_;
+        string_view line(begin + pos_, lineEnd - begin - pos_);
+        pos_ = scan_ = lineEnd + 2 - begin;
+
         switch(state_)
         {
             // 有限状态机，从请求行开始，每次处理完后会自动转入到下一个状态
-
         case REQUEST_LINE:
+            if(line.empty())                        // 忽略请求行前多余的空行
+                break;
             if(!ParseRequestLine_(line))
-                return false;
+                return PARSE_ERROR;
             ParsePath_();  // 解析路径
             break;
-        
+
         case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2)
-                state_ = FINISH;
+            if(!line.empty())
+            {
+                if(!ParseHeader_(line))
+                    return PARSE_ERROR;
+            }
+            else if(!BeginBody_())                  // 空行，请求头结束
+                return PARSE_ERROR;
             break;
-        
-        case BODY:
-            ParseBody_(line);
+
+        case CHUNK_SIZE:
+            if(!ParseChunkSize_(line))
+                return PARSE_ERROR;
+            DropLine_(buff, lineOff);
             break;
-        
+
+        case CHUNK_CRLF:                            // 块数据后面必须紧跟CRLF
+            if(!line.empty())
+            {
+                LOG_ERROR("Chunk data error");
+                return PARSE_ERROR;
+            }
+            DropLine_(buff, lineOff);
+            state_ = CHUNK_SIZE;
+            break;
+
+        case TRAILER:                               // 尾部的请求头忽略，空行表示请求结束
+            DropLine_(buff, lineOff);
+            if(line.empty())
+                FinishBody_(buff);
+            break;
+
         default:
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; }      // 读完了
-        buff.RetrieveUntil(lineEnd + 2);
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    Dispatch_();
+    LOG_DEBUG("[%s], [%s], [%s]", method_.data(), path_.data(), version_.data());   // arena中的字符串都以'\0'结尾
+    return PARSE_OK;
+}
+
+// 请求头结束后检查Content-Length，没有则认为没有请求体
+bool HttpRequest::ParseContentLength_()
+{
+    if(known_[HDR_CONTENT_LENGTH].nameLen == 0)
+        return true;
+    string_view value = GetHeader(HDR_CONTENT_LENGTH);
+    if(value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != string_view::npos)
+    {
+        LOG_ERROR("Content-Length error: %.*s", (int)value.size(), value.data());
+        return false;
+    }
+    for(char ch : value)
+        contentLen_ = contentLen_ * 10 + (ch - '0');
+    if(contentLen_ > MAX_BODY_SIZE)
+    {
+        LOG_ERROR("Body too large: %zu", contentLen_);
+        return false;
+    }
     return true;
 }
 
-// 解析路径
+// 按原始路径查路由，重写和动态路由的target先替换路径
 void HttpRequest::ParsePath_()
 {
-    if(path_ == "/")
-        path_ = "/index.html";
-    else
+    route_ = Router::Instance()->Find(method_, path_);
+    if(route_ && route_->type != Router::ROUTE_STATIC && !route_->target.empty())
+        path_ = route_->target;
+}
+
+void HttpRequest::Dispatch_()
+{
+    if(!route_ || route_->type != Router::ROUTE_DYNAMIC)
+        return;
+    if((asyncDb && route_->asyncHandler) || (deferBlocking_ && route_->mayBlock))
     {
-        for(auto &item : DEFAULT_HTML)
+        asyncPending_ = true;                       // 由reactor调用StartAsync，或把RunBlocking交给线程池
+        return;
+    }
+    string_view path = route_->handler(*this);
+    if(!path.empty())
+        path_ = path;
+}
+
+// 请求行: 方法 SP 路径 SP HTTP/版本，逐字符扫描，三段都不能为空也不能再含空白
+bool HttpRequest::ParseRequestLine_(string_view line)
+{
+    enum { METHOD, PATH, PROTOCOL, VERSION } state = METHOD;
+    const char PROTO[] = "HTTP/";
+    const size_t protoLen = sizeof(PROTO) - 1;
+    size_t start = 0;
+    string_view method, path;
+    for(size_t i = 0; i < line.size(); i++)
+    {
+        char ch = line[i];
+        switch(state)
         {
-            if(item == path_)
+        case METHOD:
+            if(ch == ' ')
             {
-                path_ += ".html";
-                break;
+                method = line.substr(start, i - start);
+                start = i + 1;
+                state = PATH;
+            }
+            else if(ch < 'A' || ch > 'Z')
+                return RequestLineError_();
+            break;
+        case PATH:
+            if(ch == ' ')
+            {
+                path = line.substr(start, i - start);
+                start = i + 1;
+                state = PROTOCOL;
             }
+            else if(static_cast<unsigned char>(ch) <= ' ' || ch == 0x7f)
+                return RequestLineError_();
+            break;
+        case PROTOCOL:
+            if(ch != PROTO[i - start])
+                return RequestLineError_();
+            if(i + 1 - start == protoLen)
+            {
+                start = i + 1;
+                state = VERSION;
+            }
+            break;
+        case VERSION:
+            if(ch == ' ' || ch == '\t')
+                return RequestLineError_();
+            break;
         }
     }
-    
+    if(state != VERSION || method.empty() || path.empty() || start == line.size())
+        return RequestLineError_();
+    method_ = arena_.Copy(method);
+    path_ = arena_.Copy(path);
+    version_ = arena_.Copy(line.substr(start));
+    state_ = HEADERS;                        // 状态转换为下一个状态
+    return true;
+}
+
+bool HttpRequest::RequestLineError_()
+{
+    LOG_ERROR("RequestLine Error");
+    return false;
+}
+
+// 请求头: 名字:值，去掉值两端的空白，格式不对的行忽略
+// 只记录位置，常用请求头按哈希放进固定槽位，同名请求头后出现的覆盖前面的
+// 例外是决定请求边界的两个：Content-Length重复且值不同、Transfer-Encoding重复时返回false(RFC 7230 3.3.2)，
+// 否则前后两端可能各取一个值，对请求边界的理解不一致
+bool HttpRequest::ParseHeader_(string_view line)
+{
+    size_t colon = line.find(':');
+    if(colon == string_view::npos || colon == 0)
+    {
+        LOG_WARN("Ignore header line without name");
+        return true;
+    }
+    string_view name = line.substr(0, colon);
+    string_view value = line.substr(colon + 1);
+    size_t first = value.find_first_not_of(" \t");
+    if(first == string_view::npos)
+        value = value.substr(value.size());
+    else
+        value = value.substr(first, value.find_last_not_of(" \t") - first + 1);
+
+    HeaderField field = {
+        static_cast<uint32_t>(name.data() - base_), static_cast<uint32_t>(name.size()),
+        static_cast<uint32_t>(value.data() - base_), static_cast<uint32_t>(value.size()),
+    };
+    int id = HEADER_TABLE[HeaderHash(name)];
+    if(id < 0 || !EqualsIgnoreCase_(name, KNOWN_HEADERS[id]))
+    {
+        headers_.push_back(field);
+        return true;
+    }
+    const HeaderField& prev = known_[id];
+    if(prev.nameLen && (id == HDR_TRANSFER_ENCODING ||
+                        (id == HDR_CONTENT_LENGTH && View_(prev.valueOff, prev.valueLen) != value)))
+    {
+        LOG_ERROR("Duplicate %.*s", (int)name.size(), name.data());
+        return false;
+    }
+    known_[id] = field;
+    return true;
 }
 
-bool HttpRequest::ParseRequestLine_(const string& line)
+// 请求头结束：分块传输和Content-Length不能同时出现，否则前后两端对请求边界的理解可能不一致
+bool HttpRequest::BeginBody_()
 {
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    // 在匹配规则中，以括号()的方式来规划分组别，一共三个括号 [0]表示整体
-    if(regex_match(line, subMatch, patten))  // 匹配指定字符串整体是否符合
+    bodyOff_ = pos_;
+    if(known_[HDR_TRANSFER_ENCODING].nameLen)
+    {
+        if(!EqualsIgnoreCase_(GetHeader(HDR_TRANSFER_ENCODING), "chunked") || known_[HDR_CONTENT_LENGTH].nameLen)
+        {
+            LOG_ERROR("Transfer-Encoding error");
+            return false;
+        }
+        state_ = CHUNK_SIZE;
+        return true;
+    }
+    if(!ParseContentLength_())
+        return false;
+    if(contentLen_ == 0)
     {
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;                    // 状态转换为下一个状态
+        state_ = FINISH;
         return true;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    if(contentLen_ > MAX_INLINE_BODY && !OpenSpool_(true))
+        return false;
+    state_ = BODY;
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line)
+// 块长度行: 16进制长度[;扩展]，扩展忽略
+bool HttpRequest::ParseChunkSize_(string_view line)
 {
-    body_ = line;
-    ParsePost_();
-    state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    size_t i = 0;
+    chunkLeft_ = 0;
+    for(; i < line.size(); i++)
+    {
+        char ch = line[i] | 0x20;
+        int value = (ch >= '0' && ch <= '9') ? ch - '0' : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+        if(value < 0)
+            break;
+        if(i >= 8)                                  // 超过4G的块不接受，也避免溢出
+            break;
+        chunkLeft_ = chunkLeft_ * 16 + value;
+    }
+    if(i == 0 || (i < line.size() && line[i] != ';' && line[i] != ' ' && line[i] != '\t'))
+    {
+        LOG_ERROR("Chunk size error");
+        return false;
+    }
+    if(chunkLeft_ > MAX_BODY_SIZE - bodyLen_)
+    {
+        LOG_ERROR("Body too large");
+        return false;
+    }
+    state_ = chunkLeft_ > 0 ? CHUNK_DATA : TRAILER;
+    return true;
 }
 
-// 16进制转换为10进制
-int HttpRequest::ConverHex(char ch)
+// 返回PARSE_OK表示这一段请求体已经收完，可以继续解析后面的内容
+HttpRequest::PARSE_RESULT HttpRequest::ParseBody_(Buffer& buff)
 {
-    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
-    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
-    return ch;
+    size_t avail = buff.ReadableBytes() - pos_;
+    if(state_ == BODY && bodyFd_ < 0)               // 短的请求体等全部到达后一次处理
+    {
+        if(avail < contentLen_)
+            return PARSE_AGAIN;
+        pos_ += contentLen_;
+        bodyLen_ = contentLen_;
+        FinishBody_(buff);
+        return PARSE_OK;
+    }
+    size_t left = state_ == BODY ? contentLen_ - bodyLen_ : chunkLeft_;
+    size_t len = min(avail, left);
+    if(!AppendBody_(buff, len))
+        return PARSE_ERROR;
+    if(len < left)
+    {
+        chunkLeft_ -= state_ == CHUNK_DATA ? len : 0;
+        return PARSE_AGAIN;
+    }
+    if(state_ == CHUNK_DATA)
+    {
+        chunkLeft_ = 0;
+        state_ = CHUNK_CRLF;
+    }
+    else
+        FinishBody_(buff);
+    return PARSE_OK;
 }
 
-// 处理post请求
-void HttpRequest::ParsePost_()
+// [pos_, pos_ + len)是新收到的请求体：没有超过窗口时留在原处，否则写入临时文件后从buff中删掉
+// 第一次超过窗口时把之前留下的部分一起转存
+bool HttpRequest::AppendBody_(Buffer& buff, size_t len)
 {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded")
+    if(len == 0)
+        return true;
+    bodyLen_ += len;
+    if(bodyFd_ < 0 && bodyLen_ <= MAX_INLINE_BODY)
     {
-        ParseFromUrlencoded_();           //  post请求体实例
-        if(DEFAULT_HTML_TAG.count(path_)) // 如果是登录/注册的path
+        pos_ += len;
+        scan_ = pos_;
+        return true;
+    }
+    if(bodyFd_ < 0)
+    {
+        if(!OpenSpool_(false))
+            return false;
+        len += pos_ - bodyOff_;
+        pos_ = bodyOff_;
+    }
+    const char* data = buff.Peek() + pos_;
+    for(size_t written = 0; written < len; )
+    {
+        ssize_t n = ::write(bodyFd_, data + written, len - written);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
         {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1)
-            {
-                bool isLogin = (tag == 1); // 1则是登录
-                if(UserVerity(post_["username"], post_["password"], isLogin))
-                    path_ = "/welcome.html";
-                else
-                    path_ = "/error.html";
-            }
+            LOG_ERROR("Write spool file error: %d", errno);
+            return false;
         }
+        written += n;
     }
+    buff.Erase(pos_, len);
+    scan_ = pos_;
+    return true;
 }
 
-// 从url中解析编码
-void HttpRequest::ParseFromUrlencoded_()
+void HttpRequest::DropLine_(Buffer& buff, size_t lineOff)
 {
-    if(body_.size() == 0) return ;
+    buff.Erase(lineOff, pos_ - lineOff);
+    pos_ = scan_ = lineOff;
+}
 
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
+void HttpRequest::FinishBody_(Buffer& buff)
+{
+    state_ = FINISH;
+    if(bodyFd_ >= 0)
+    {
+        lseek(bodyFd_, 0, SEEK_SET);
+        LOG_DEBUG("Body spooled, len:%zu", bodyLen_);
+        return;
+    }
+    body_ = arena_.Copy(string_view(buff.Peek() + bodyOff_, bodyLen_));
+    ParsePost_();
+    LOG_DEBUG("Body:%s, len:%zu", body_.data(), body_.size());
+}
 
-    for(; i < n ; ++i)
+// 匿名临时文件关闭后自动删除；文件系统不支持O_TMPFILE时创建后立即unlink
+bool HttpRequest::OpenSpool_(bool splice)
+{
+    bodyFd_ = open(spoolDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(bodyFd_ < 0)
     {
-        char ch = body_[i];
-        switch(ch)
-        {
-            // key
-        case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-            // 键值对中的空格换为+或者%20
-        case '+':
-            body_[i] = ' ';
-            break;
-        case '%':
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-            // 键值对连接符
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
-        }
+        char path[256];
+        snprintf(path, sizeof(path), "%s/bodyXXXXXX", spoolDir);
+        bodyFd_ = mkostemp(path, O_CLOEXEC);
+        if(bodyFd_ >= 0)
+            unlink(path);
     }
-    assert(j <= i);
-    if(post_.count(key) == 0 && j < i)
+    if(bodyFd_ < 0)
+    {
+        LOG_ERROR("Open spool file in %s error: %d", spoolDir, errno);
+        return false;
+    }
+    if(splice && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0)
+        pipe_[0] = pipe_[1] = -1;                   // 没有管道就经过读缓冲写入
+    return true;
+}
+
+void HttpRequest::CloseBody_()
+{
+    if(bodyFd_ >= 0)
+        close(bodyFd_);
+    if(pipe_[0] >= 0)
     {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+        close(pipe_[0]);
+        close(pipe_[1]);
     }
+    bodyFd_ = pipe_[0] = pipe_[1] = -1;
+}
+
+// 一次最多搬一个管道容量，先从socket进管道，再全部从管道写进文件，管道在两次调用之间总是空的
+ssize_t HttpRequest::SpliceBody(int sockFd, int* saveErrno)
+{
+    assert(CanSplice());
+    ssize_t len = splice(sockFd, nullptr, pipe_[1], nullptr, contentLen_ - bodyLen_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(len <= 0)
+    {
+        if(len < 0)
+            *saveErrno = errno;
+        return len;
+    }
+    for(ssize_t left = len; left > 0; )
+    {
+        ssize_t n = splice(pipe_[0], nullptr, bodyFd_, nullptr, left, SPLICE_F_MOVE);
+        if(n <= 0)
+        {
+            *saveErrno = n < 0 ? errno : EIO;
+            LOG_ERROR("Splice to spool file error: %d", *saveErrno);
+            return -1;
+        }
+        left -= n;
+    }
+    bodyLen_ += len;
+    return len;
+}
+
+// 处理post请求，表单解析后由路由的处理函数通过GetPost读取
+void HttpRequest::ParsePost_()
+{
+    if(method_ == "POST" && GetHeader(HDR_CONTENT_TYPE) == "application/x-www-form-urlencoded")
+        ParseFromUrlencoded_();           //  post请求体实例
 }
 
-bool HttpRequest::UserVerity(const string& name, const string& pwd, bool isLogin)
+string_view HttpRequest::Login_(const HttpRequest& request)
 {
-    if(name == "" || pwd == "") return false;
-    LOG_INFO("Verity name:%s pwd %s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    SqlConnRAII(&sql, SqlConnPool::Instance());
-    assert(sql);
+    return request.VerifyForm_(true);
+}
 
-    bool flag = false;
-    unsigned int j = 0;
-    char order[256] = {0};
-    MYSQL_FIELD* fields = nullptr;
-    MYSQL_RES* res = nullptr;
+string_view HttpRequest::Register_(const HttpRequest& request)
+{
+    return request.VerifyForm_(false);
+}
 
-    if(!isLogin) flag = true;
+void HttpRequest::LoginAsync_(const HttpRequest& request, AsyncSqlPool* sql, Router::AsyncDone done)
+{
+    request.VerifyFormAsync_(true, sql, move(done));
+}
 
-    // 查询用户以及密码
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order)
+void HttpRequest::RegisterAsync_(const HttpRequest& request, AsyncSqlPool* sql, Router::AsyncDone done)
+{
+    request.VerifyFormAsync_(false, sql, move(done));
+}
 
-    if(mysql_query(sql, order))
+// 只处理带请求体的表单，其余返回空，发送路由的target
+bool HttpRequest::IsForm_() const
+{
+    return !body_.empty() && GetHeader(HDR_CONTENT_TYPE) == "application/x-www-form-urlencoded";
+}
+
+string_view HttpRequest::VerifyForm_(bool isLogin) const
+{
+    if(!IsForm_())
+        return string_view();
+    if(UserVerity(GetPost("username"), GetPost("password"), isLogin))
+        return "/welcome.html";
+    return "/error.html";
+}
+
+void HttpRequest::VerifyFormAsync_(bool isLogin, AsyncSqlPool* sql, Router::AsyncDone done) const
+{
+    if(!IsForm_())
     {
-        mysql_free_result(res);
-        return false;
+        done(string_view());
+        return;
     }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_field(res);
+    UserVerityAsync(GetPost("username"), GetPost("password"), isLogin, sql, [done](bool ok)
+    {
+        done(ok ? "/welcome.html" : "/error.html");
+    });
+}
+
+// 解析表单：按'&'分字段，按第一个'='分键值，键和值在body_的副本上原地解码，body()保持原样
+void HttpRequest::ParseFromUrlencoded_()
+{
+    if(body_.size() == 0) return ;
 
+    size_t fields = count(body_.begin(), body_.end(), '&') + 1;
+    post_ = static_cast<PostField*>(arena_.Allocate(fields * sizeof(PostField), alignof(PostField)));
+    char* body = const_cast<char*>(arena_.Copy(body_).data());
+    size_t begin = 0;
+    while(begin < body_.size())
+    {
+        size_t end = body_.find('&', begin);
+        if(end == string_view::npos)
+            end = body_.size();
+        size_t eq = body_.find('=', begin);
+        if(eq > end)
+            eq = end;
+        if(eq > begin)                      // 没有键的字段忽略
+        {
+            PostField& field = post_[postCount_++];
+            field.key = string_view(body + begin, UrlDecoder::Decode(body + begin, eq - begin, body + begin));
+            if(eq < end)
+                field.value = string_view(body + eq + 1, UrlDecoder::Decode(body + eq + 1, end - eq - 1, body + eq + 1));
+            else
+                field.value = string_view();
+            LOG_DEBUG("%.*s = %.*s", (int)field.key.size(), field.key.data(), (int)field.value.size(), field.value.data());
+        }
+        begin = end + 1;
+    }
+}
+
+// 根据查询用户名的结果判断：登录要求密码一致，注册要求用户名没有被使用
+bool HttpRequest::CheckUser_(MYSQL_RES* res, string_view pwd, bool isLogin)
+{
+    bool flag = !isLogin;
     while(MYSQL_ROW row = mysql_fetch_row(res))
     {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        // 注册行为
         if(isLogin)
-            if(pwd == password)
-                flag = true;
-            else
-            {
-                flag = false;
+        {
+            flag = (pwd == row[1]);
+            if(!flag)
                 LOG_INFO("pwd error!");
-            }
+        }
         else
         {
             flag = false;
             LOG_INFO("user used!");
         }
     }
-    mysql_free_result(res);
+    return flag;
+}
+
+// 缓存能给出结论时返回true，结论放在*flag中：重复登录由缓存确认；缓存里有这个用户名时注册必然失败
+// 缓存中密码不一致时库里的密码可能已经改过，仍要查库
+static bool VerityByCache(string_view name, string_view pwd, bool isLogin, bool* flag)
+{
+    UserCache::RESULT cached = UserCache::Instance()->Find(name, pwd);
+    if(isLogin && cached == UserCache::MATCH)
+    {
+        *flag = true;
+        return true;
+    }
+    if(!isLogin && cached != UserCache::ABSENT)
+    {
+        LOG_INFO("user used!");
+        *flag = false;
+        return true;
+    }
+    return false;
+}
+
+// 过滤器确定用户名不存在时返回true：登录直接失败，注册不必先查询
+// 注册时同时把用户名加入过滤器，检查和加入是原子的，并发注册同一用户名时只有一个能跳过查询；插入失败只多一个误判
+static bool AbsentByFilter(string_view name, bool isLogin)
+{
+    UserFilter* filter = UserFilter::Instance();
+    if(isLogin ? filter->MayContain(name) : !filter->Add(name))
+        return false;
+    filter->CountSkip();
+    return true;
+}
+
+// 按用户名查找的结果，合并时由等待者共享
+struct UserRow
+{
+    UserStore::RESULT result;
+    string password;
+};
+
+// 登录的查找按用户名合并：同一用户名并发的登录只有一个去查库，其余等它的结果，不再各占一个连接
+// 本地引擎的查找比合并本身还快，不合并
+static SingleFlight<UserRow> LOGIN_LOOKUPS;
+
+static UserRow LookupLogin(UserStore* store, string_view name)
+{
+    auto lookup = [store, name]()
+    {
+        UserRow row;
+        row.result = store->Find(name, &row.password);
+        return row;
+    };
+    if(!HttpRequest::singleFlight || !store->Remote())
+        return lookup();
+    return LOGIN_LOOKUPS.Do(name, lookup);
+}
+
+bool HttpRequest::UserVerity(string_view name, string_view pwd, bool isLogin)
+{
+    if(name.empty() || pwd.empty()) return false;
+    LOG_INFO("Verity name:%.*s pwd %.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
+    bool flag;
+    if(VerityByCache(name, pwd, isLogin, &flag))
+        return flag;
+    bool absent = AbsentByFilter(name, isLogin);
+    if(absent && isLogin)
+    {
+        LOG_INFO("user not exist!");
+        return false;
+    }
 
-    // 注册行为 且 用户名没有被使用
-    if(!isLogin && flag == true)
+    UserStore* store = UserStore::Instance();
+    if(isLogin)
+    {
+        UserRow row = LookupLogin(store, name);
+        flag = (row.result == UserStore::OK && pwd == row.password);
+        if(row.result == UserStore::OK && !flag)
+            LOG_INFO("pwd error!");
+    }
+    else
     {
-        LOG_DEBUG("register!");
-        bzero(order, 256);
-        snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s', '%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG("%s", order);
-        if(mysql_query(sql, order))
+        // 注册行为
+        UserStore::RESULT res = store->Insert(name, pwd, absent);
+        flag = (res == UserStore::OK);
+        if(res == UserStore::EXISTS)
         {
-            LOG_DEBUG("Insert error!");
-            flag = false;
+            LOG_INFO("user used!");
+        }
+        else if(flag)
+        {
+            LOG_DEBUG("register!");
         }
-        flag = true;
     }
-    // SqlConnPool::Instance()->FreeConn(sql);
+    if(flag)
+        UserCache::Instance()->Put(name, pwd);      // 登录成功或注册成功，写入缓存
     LOG_DEBUG("UserVerify success!!");
     return flag;
 }
 
-string HttpRequest::path() const
+// 与UserVerity的流程相同，两条语句都交给reactor的异步连接执行，回调在reactor线程中调用
+// 只用于MySQL引擎，服务器使用其他引擎时不启用异步连接
+// 等待期间连接可能关闭，请求的arena会被回收，后面还要用的用户名和密码复制一份
+void HttpRequest::UserVerityAsync(string_view name, string_view pwd, bool isLogin, AsyncSqlPool* sql,
+                                  function<void(bool)> done)
 {
-    return path_;
+    if(name.empty() || pwd.empty())
+    {
+        done(false);
+        return;
+    }
+    LOG_INFO("Verity name:%.*s pwd %.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
+    bool flag;
+    if(VerityByCache(name, pwd, isLogin, &flag))
+    {
+        done(flag);
+        return;
+    }
+    bool absent = AbsentByFilter(name, isLogin);
+    if(absent && isLogin)
+    {
+        LOG_INFO("user not exist!");
+        done(false);
+        return;
+    }
+    // 非阻塞接口下仍用文本协议，值先转义
+    string escName = sql->Escape(name);
+    auto insert = [sql, escName](const string& name, const string& pwd, function<void(bool)> done)
+    {
+        string order = "INSERT INTO user(username, password) VALUES('" + escName + "', '" + sql->Escape(pwd) + "')";
+        sql->Query(move(order), [name, pwd, done = move(done)](MYSQL_RES*, bool ok)
+        {
+            if(ok)
+                UserCache::Instance()->Put(name, pwd);
+            done(ok);
+        });
+    };
+    if(absent)
+    {
+        insert(string(name), string(pwd), move(done));
+        return;
+    }
+    // 登录的查询与同一reactor上相同的查询合并
+    string order = "SELECT username, password FROM user WHERE username='" + escName + "' LIMIT 1";
+    sql->Query(move(order), isLogin && singleFlight, [isLogin, name = string(name), pwd = string(pwd), done = move(done), insert](MYSQL_RES* res, bool ok)
+    {
+        if(!ok || !res || !CheckUser_(res, pwd, isLogin))
+        {
+            done(false);
+            return;
+        }
+        if(isLogin)
+        {
+            UserCache::Instance()->Put(name, pwd);
+            done(true);
+            return;
+        }
+        insert(name, pwd, done);
+    });
 }
 
-string& HttpRequest::path()
+const Router::Route* HttpRequest::FindRoute_(const char* begin, const char* end)
+{
+    const char* methodEnd = find(begin, end, ' ');
+    if(methodEnd == end)
+        return nullptr;
+    const char* pathBegin = methodEnd + 1;
+    const char* pathEnd = find(pathBegin, end, ' ');
+    return Router::Instance()->Find(string_view(begin, methodEnd - begin), string_view(pathBegin, pathEnd - pathBegin));
+}
+
+// 在请求行上查路由，只有注册为会阻塞的动态路由(登录/注册)才交给线程池，能异步执行的除外
+bool HttpRequest::MayBlock(const char* begin, const char* end)
+{
+    const Router::Route* route = FindRoute_(begin, end);
+    return route && route->mayBlock && !(asyncDb && route->asyncHandler);
+}
+
+bool HttpRequest::IsAsync(const char* begin, const char* end)
+{
+    const Router::Route* route = FindRoute_(begin, end);
+    return asyncDb && route && route->asyncHandler;
+}
+
+void HttpRequest::StartAsync(AsyncSqlPool* sql, Router::AsyncDone done) const
+{
+    assert(asyncPending_ && sql);
+    route_->asyncHandler(*this, sql, move(done));
+}
+
+string_view HttpRequest::RunBlocking() const
+{
+    assert(asyncPending_);
+    return route_->handler(*this);
+}
+
+void HttpRequest::FinishAsync(string_view path)
+{
+    assert(asyncPending_);
+    asyncPending_ = false;
+    if(!path.empty())
+        path_ = path;
+}
+
+bool HttpRequest::IsKeepAlive() const
+{
+    return version_ == "1.1" && EqualsIgnoreCase_(GetHeader(HDR_CONNECTION), "keep-alive");
+}
+
+string_view HttpRequest::GetHeader(HEADER_ID id) const
+{
+    assert(id >= 0 && id < HDR_KNOWN_COUNT);
+    const HeaderField& field = known_[id];
+    return field.nameLen ? View_(field.valueOff, field.valueLen) : string_view();
+}
+
+string_view HttpRequest::GetHeader(string_view name) const
+{
+    if(name.empty())
+        return string_view();
+    int id = HEADER_TABLE[HeaderHash(name)];
+    if(id >= 0 && EqualsIgnoreCase_(name, KNOWN_HEADERS[id]))
+        return GetHeader(static_cast<HEADER_ID>(id));
+    for(auto it = headers_.rbegin(); it != headers_.rend(); ++it)
+    {
+        if(EqualsIgnoreCase_(View_(it->nameOff, it->nameLen), name))
+            return View_(it->valueOff, it->valueLen);
+    }
+    return string_view();
+}
+
+bool HttpRequest::EqualsIgnoreCase_(string_view a, string_view b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); i++)
+    {
+        if(tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+string_view HttpRequest::path() const
 {
     return path_;
 }
 
-string HttpRequest::method() const
+string_view HttpRequest::method() const
 {
     return method_;
 }
 
-string HttpRequest::version() const
+string_view HttpRequest::version() const
 {
     return version_;
 }
 
-string HttpRequest::GetPost(const string& key) const
+string_view HttpRequest::body() const
 {
-    assert(key != "");
-    if(post_.count(key) == 1)
-        return post_.find(key)->second;
-    return "";
+    return body_;
 }
 
-string HttpRequest::GetPost(const char* key) const
+string_view HttpRequest::GetPost(string_view key) const
 {
-    assert(key != nullptr);
-    if(post_.count(key) == 1)
-        return post_.find(key)->second;
-    return "";
+    assert(!key.empty());
+    for(size_t i = 0; i < postCount_; i++)
+    {
+        if(post_[i].key == key)
+            return post_[i].value;
+    }
+    return string_view();
 }
@@ -4,13 +4,27 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <stdint.h>
 #include <error.h>
+#include <fcntl.h>              // open, splice
+#include <unistd.h>
 #include <mysql/mysql.h>
 
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "urldecoder.h"
+#include "router.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
+#include "../pool/asyncsql.h"
+#include "../pool/usercache.h"
+#include "../pool/userfilter.h"
+#include "../pool/userstore.h"
+#include "../pool/singleflight.h"
 
 using namespace std;
 
@@ -21,44 +35,164 @@ public:
     {
         REQUEST_LINE,
         HEADERS,
-        BODY,
+        BODY,                                       // Content-Length
+        CHUNK_SIZE,                                 // Transfer-Encoding: chunked
+        CHUNK_DATA,
+        CHUNK_CRLF,
+        TRAILER,
         FINISH,
     };
 
-    HttpRequest() { Init(); }
-    ~HttpRequest() = default;
+    enum PARSE_RESULT
+    {
+        PARSE_AGAIN,                                // 数据不完整，等待更多数据后再次调用
+        PARSE_OK,                                   // 解析出一个完整请求(内部表示可以继续解析)
+        PARSE_ERROR,
+    };
+
+    // 常用请求头，解析时由编译期的完美哈希直接放进固定槽位
+    enum HEADER_ID
+    {
+        HDR_CONNECTION,
+        HDR_CONTENT_LENGTH,
+        HDR_CONTENT_TYPE,
+        HDR_HOST,
+        HDR_ACCEPT_ENCODING,
+        HDR_IF_NONE_MATCH,
+        HDR_RANGE,
+        HDR_TRANSFER_ENCODING,
+        HDR_KNOWN_COUNT,
+    };
+
+    // mem为请求arena的内存来源，为空时用malloc
+    explicit HttpRequest(pmr::memory_resource* mem = nullptr)
+        : bodyFd_(-1), pipe_{-1, -1}, arena_(Arena::DEFAULT_BLOCK, mem), deferBlocking_(false) { Init(); }
+    ~HttpRequest() { CloseBody_(); }
 
     void Init();
-    bool parse(Buffer& buff);
+    PARSE_RESULT parse(Buffer& buff);
+    size_t Length() const { return pos_; }          // 已解析的请求在buff中占用的字节数(已转存的请求体不算)
 
-    string path() const;
-    string& path();
-    string method() const;
-    string version() const;
-    string GetPost(const string& key) const;
-    string GetPost(const char* key) const;
+    // 以下返回的视图都指向请求自己的arena，不拷贝；下一个请求开始解析(Init)后失效，
+    // 需要保存时由调用者自己复制。表单的值不以'\0'结尾
+    string_view path() const;
+    string_view method() const;
+    string_view version() const;
+    string_view body() const;                           // 请求体转存到临时文件时为空
+    string_view GetPost(string_view key) const;         // 没有该字段时返回空
 
     bool IsKeepAlive() const;
 
+    // 超过MAX_INLINE_BODY的请求体边收边写到spoolDir下的匿名临时文件，读缓冲只保留请求头，
+    // 每个连接占用的内存与请求体大小无关；解析完成后文件偏移在开头，供处理函数读取，下一个请求开始时关闭
+    int BodyFd() const { return bodyFd_; }              // 请求体在内存中时为-1
+    size_t BodyLength() const { return bodyLen_; }
+
+    // Content-Length的请求体转存时，剩余部分可以由内核经管道从socket直接搬到文件，不经过读缓冲
+    bool CanSplice() const { return state_ == BODY && pipe_[0] >= 0 && bodyLen_ < contentLen_; }
+    ssize_t SpliceBody(int sockFd, int* saveErrno);     // 返回值和saveErrno的含义同read
+
+    // 请求头的值指向读缓冲，只在解析成功到调用者取走请求之间有效；没有该请求头时返回空
+    string_view GetHeader(HEADER_ID id) const;
+    string_view GetHeader(string_view name) const;      // 名字不区分大小写
+
+    static bool MayBlock(const char* begin, const char* end);  // 只看请求行，判断路由的处理函数是否会阻塞
+    static bool IsAsync(const char* begin, const char* end);   // 只看请求行，判断是否由异步处理函数处理
+
+    // 匹配到异步处理函数的请求parse()返回PARSE_OK后处于等待状态：调用者在reactor线程中StartAsync，
+    // 完成回调里FinishAsync设置路径后再生成响应；等待期间请求和读缓冲都不能动
+    bool AsyncPending() const { return asyncPending_; }
+    void StartAsync(AsyncSqlPool* sql, Router::AsyncDone done) const;
+    void FinishAsync(string_view path);
+    string_view RunBlocking() const;                    // 异步连接不可用时改调阻塞的处理函数，返回值交给FinishAsync
+    bool HasAsyncHandler() const { return asyncDb && route_ && route_->asyncHandler; }
+
+    // 为true时会阻塞的动态路由也像异步处理函数一样停在等待状态，由调用者把RunBlocking交给其他线程(io_uring)
+    // 不随Init()清除
+    void DeferBlocking(bool on) { deferBlocking_ = on; }
+
+    // 内置路由：页面名补全.html，登录/注册交给查询数据库的处理函数
+    static void AddDefaultRoutes(Router* router);
+
+    static const char* spoolDir;                        // 临时文件所在目录，默认/tmp
+    static bool asyncDb;                                // 服务器启用了异步数据库连接，默认false
+    static bool singleFlight;                           // 合并同一用户名并发的登录查询，默认true
+
 private:
-    bool ParseRequestLine_(const string& line);     // 处理请求行
-    void ParseHeader_(const string& line);          // 处理请求头
-    void ParseBody_(const string& line);            // 处理请求体
+    bool ParseRequestLine_(string_view line);       // 处理请求行
+    bool ParseHeader_(string_view line);            // 处理请求头
+    static bool RequestLineError_();
+    bool ParseContentLength_();
+    bool BeginBody_();                              // 请求头结束，确定请求体的传输方式
+    bool ParseChunkSize_(string_view line);
+    PARSE_RESULT ParseBody_(Buffer& buff);          // 处理[pos_, 读缓冲末尾)中属于请求体的数据
+    bool AppendBody_(Buffer& buff, size_t len);
+    void DropLine_(Buffer& buff, size_t lineOff);   // 分块的长度行、结尾空行等从读缓冲中删掉
+    void FinishBody_(Buffer& buff);
+    bool OpenSpool_(bool splice);
+    void CloseBody_();
+    string_view View_(uint32_t off, uint32_t len) const { return string_view(base_ + off, len); }
+    static bool EqualsIgnoreCase_(string_view a, string_view b);
+    static const char* FindCRLF_(const char* lineBegin, const char* scan, const char* end);
 
-    void ParsePath_();                              // 处理请求路径
+    void ParsePath_();                              // 查路由，处理重写
     void ParsePost_();                              // 处理Post事件
     void ParseFromUrlencoded_();                    // 从url中解析编码
+    void Dispatch_();                               // 请求完整后调用动态路由的处理函数
 
-    static bool UserVerity(const string& name, const string& pwd, bool isLogin);   // 用户验证
+    static const Router::Route* FindRoute_(const char* begin, const char* end);
+
+    static string_view Login_(const HttpRequest& request);
+    static string_view Register_(const HttpRequest& request);
+    static void LoginAsync_(const HttpRequest& request, AsyncSqlPool* sql, Router::AsyncDone done);
+    static void RegisterAsync_(const HttpRequest& request, AsyncSqlPool* sql, Router::AsyncDone done);
+    bool IsForm_() const;
+    string_view VerifyForm_(bool isLogin) const;
+    void VerifyFormAsync_(bool isLogin, AsyncSqlPool* sql, Router::AsyncDone done) const;
+    static bool CheckUser_(MYSQL_RES* res, string_view pwd, bool isLogin);
+    static bool UserVerity(string_view name, string_view pwd, bool isLogin);   // 用户验证
+    static void UserVerityAsync(string_view name, string_view pwd, bool isLogin, AsyncSqlPool* sql,
+                                function<void(bool)> done);
 
     PARSE_STATE state_;
-    string method_, path_, version_, body_;
-    unordered_map<string, string> header_;
-    unordered_map<string, string> post_;
+    size_t pos_;                                    // 下一行的起始偏移(相对buff.Peek())
+    size_t scan_;                                   // 已经找过换行的位置
+    size_t contentLen_;
+    size_t bodyOff_;                                // 请求体在buff中的起始偏移
+    size_t bodyLen_;                                // 已收到的请求体长度(分块时为去掉分块格式后的长度)
+    size_t chunkLeft_;                              // 当前块还没收到的字节数
+    int bodyFd_;                                    // 请求体的临时文件
+    int pipe_[2];                                   // splice用的管道，分块传输时不用
+    // 请求期间的字符串和容器都从arena_分配，Init()时O(1)整体回收
+    Arena arena_;
+    string_view method_, path_, version_, body_;
+    const Router::Route* route_;                    // 请求行匹配到的路由，没有则为nullptr
+    bool asyncPending_;
+    bool deferBlocking_;
+
+    // 请求头在读缓冲中的位置，偏移相对于buff.Peek()，读缓冲扩容搬移后仍然有效
+    struct HeaderField
+    {
+        uint32_t nameOff, nameLen;
+        uint32_t valueOff, valueLen;
+    };
+    const char* base_;                              // 最近一次parse时的buff.Peek()
+    HeaderField known_[HDR_KNOWN_COUNT];            // nameLen为0表示没有该请求头
+    vector<HeaderField> headers_;                   // 其余请求头，clear()后容量复用
+
+    // 表单字段，数组在arena中，键值是body_副本上原地解码后的视图；字段少，线性查找即可
+    struct PostField
+    {
+        string_view key, value;
+    };
+    PostField* post_;
+    size_t postCount_;
+
+    static const bool DEFAULT_ROUTES_ADDED;         // 静态初始化时向Router::Instance()注册内置路由
 
-    static const unordered_set<string> DEFAULT_HTML;
-    static const unordered_map<string, int> DEFAULT_HTML_TAG;
-    static int ConverHex(char ch);                  // 16进制转换为10进制
+    static const size_t MAX_HEADER_SIZE = 64 * 1024;
+    static const size_t MAX_INLINE_BODY = 64 * 1024;           // 不超过这个长度的请求体留在读缓冲中
+    static const size_t MAX_BODY_SIZE = 512 * 1024 * 1024;
 
 };
 
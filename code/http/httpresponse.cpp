@@ -2,7 +2,7 @@
 
 using namespace std;
 
-const unordered_map<string,string> HttpResponse::SUFFIX_TYPE = 
+const unordered_map<string_view, string> HttpResponse::SUFFIX_TYPE = 
 {
     {".html", "text/html"},
     {".xml", "text/xml"},
@@ -41,7 +41,7 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
 HttpResponse::HttpResponse()
 {
     code_ = -1;
-    path_ = srcDir_ = "";
+    path_ = srcDir_ = string_view();
     isKeepAlive_ = false;
     mmFile_ = nullptr;
     mmFileStat_ = {0};
@@ -52,9 +52,9 @@ HttpResponse::~HttpResponse()
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code)
+void HttpResponse::Init(string_view srcDir, string_view path, bool isKeepAlive, int code)
 {
-    assert(srcDir != "");
+    assert(!srcDir.empty());
     if(mmFile_) { UnmapFile(); }
     code_ = code;
     isKeepAlive_ = isKeepAlive;
@@ -67,7 +67,7 @@ void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, in
 void HttpResponse::MakeResponse(Buffer& buff)
 {
     // 判断请求的资源文件
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode))
+    if(stat(FilePath_(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode))
         code_ = 404;
     else if(!(mmFileStat_.st_mode & S_IROTH))
         code_ = 403;
@@ -88,4 +88,120 @@ char* HttpResponse::File()
 size_t HttpResponse::FileLen() const
 {
     return mmFileStat_.st_size;
-}
\ No newline at end of file
+}
+
+char* HttpResponse::ReleaseFile()
+{
+    char* file = mmFile_;
+    mmFile_ = nullptr;
+    return file;
+}
+
+void HttpResponse::UnmapFile()
+{
+    if(mmFile_)
+    {
+        munmap(mmFile_, mmFileStat_.st_size);
+        mmFile_ = nullptr;
+    }
+}
+
+// 错误码对应的页面
+void HttpResponse::ErrorHtml_()
+{
+    if(CODE_PATH.count(code_) == 1)
+    {
+        path_ = CODE_PATH.find(code_)->second;
+        stat(FilePath_(), &mmFileStat_);
+    }
+}
+
+// 状态行
+void HttpResponse::AddStateLine_(Buffer& buff)
+{
+    auto status = CODE_STATUS.find(code_);
+    if(status == CODE_STATUS.end())
+    {
+        code_ = 400;
+        status = CODE_STATUS.find(400);
+    }
+    char line[64];
+    int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code_, status->second.c_str());
+    buff.Append(line, len);
+}
+
+// 响应头
+void HttpResponse::AddHeader_(Buffer& buff)
+{
+    buff.Append("Connection: ");
+    if(isKeepAlive_)
+    {
+        buff.Append("keep-alive\r\n");
+        buff.Append("keep-alive: max=6, timeout=120\r\n");
+    }
+    else
+        buff.Append("close\r\n");
+    buff.Append("Content-type: ");
+    buff.Append(GetFileType_());
+    buff.Append("\r\n");
+}
+
+// 响应体，文件通过mmap映射，由HttpConn聚集写出
+void HttpResponse::AddContent_(Buffer& buff)
+{
+    int srcFd = open(FilePath_(), O_RDONLY);
+    if(srcFd < 0)
+    {
+        ErrorContent(buff, "File NotFound!");
+        return;
+    }
+    LOG_DEBUG("file path %s", filePath_.c_str());
+    // MAP_PRIVATE 建立一个写入时拷贝的私有映射
+    void* mmRet = mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+    close(srcFd);
+    if(mmRet == MAP_FAILED)
+    {
+        ErrorContent(buff, "File NotFound!");
+        return;
+    }
+    mmFile_ = static_cast<char*>(mmRet);
+    char line[64];
+    int len = snprintf(line, sizeof(line), "Content-length: %lld\r\n\r\n", (long long)mmFileStat_.st_size);
+    buff.Append(line, len);
+}
+
+const char* HttpResponse::FilePath_()
+{
+    filePath_.assign(srcDir_).append(path_);
+    return filePath_.c_str();
+}
+
+const string& HttpResponse::GetFileType_()
+{
+    static const string DEFAULT_TYPE = "text/plain";
+    size_t idx = path_.find_last_of('.');
+    if(idx == string_view::npos)
+        return DEFAULT_TYPE;
+    auto it = SUFFIX_TYPE.find(path_.substr(idx));
+    if(it != SUFFIX_TYPE.end())
+        return it->second;
+    return DEFAULT_TYPE;
+}
+
+void HttpResponse::ErrorContent(Buffer& buff, string message)
+{
+    string body;
+    string status;
+    body += "<html><title>Error</title>";
+    body += "<body bgcolor=\"ffffff\">";
+    if(CODE_STATUS.count(code_) == 1)
+        status = CODE_STATUS.find(code_)->second;
+    else
+        status = "Bad Request";
+    body += to_string(code_) + " : " + status + "\n";
+    body += "<p>" + message + "</p>";
+    body += "<hr><em>TinyWebServer</em></body></html>";
+
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.Append(body);
+}
@@ -2,6 +2,7 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <string_view>
 #include <fcntl.h>              // open
 #include <unistd.h>             // 
 #include <sys/stat.h>
@@ -16,13 +17,15 @@ public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const string& srcDir_, string& path_, bool isKeepAlive_ = false, int code = -1);
+    void Init(string_view srcDir_, string_view path_, bool isKeepAlive_ = false, int code = -1);
     void MakeResponse(Buffer& buff);
     void UnmapFile();
     char* File();
+    char* ReleaseFile();                                // 映射交给调用者，之后由调用者munmap
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, string message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
 
 private:
     void AddStateLine_(Buffer &buff);
@@ -30,18 +33,21 @@ private:
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
-    string GetFileType_();
+    const string& GetFileType_();
+    const char* FilePath_();                            // srcDir_ + path_，复用filePath_的容量
 
     int code_;
     bool isKeepAlive_;
 
-    string path_;
-    string srcDir_;
+    // Init传入的视图只需在MakeResponse返回前有效，不做拷贝
+    string_view path_;
+    string_view srcDir_;
+    string filePath_;                                   // 拼接后的文件路径，复用容量
 
     char* mmFile_;
     struct stat mmFileStat_;
 
-    static const unordered_map<string, string> SUFFIX_TYPE;  // 后缀类型集
+    static const unordered_map<string_view, string> SUFFIX_TYPE;  // 后缀类型集，键指向字面量
     static const unordered_map<int, string> CODE_STATUS;  // 编码状态集
     static const unordered_map<int, string> CODE_PATH;  // 编码路径集
 };
@@ -0,0 +1,116 @@
+#include "router.h"
+
+Router* Router::Instance()
+{
+    static Router router;
+    return &router;
+}
+
+Router::Router() : table_(INIT_SIZE), count_(0)
+{
+}
+
+void Router::AddStatic(string_view method, string_view path)
+{
+    Add_(method, path, {ROUTE_STATIC, string_view(), nullptr, false, nullptr});
+}
+
+void Router::AddRewrite(string_view method, string_view path, string_view target)
+{
+    assert(!target.empty());
+    Add_(method, path, {ROUTE_REWRITE, Store_(target), nullptr, false, nullptr});
+}
+
+void Router::AddDynamic(string_view method, string_view path, Handler handler, bool mayBlock, string_view target,
+                        AsyncHandler asyncHandler)
+{
+    assert(handler);
+    Add_(method, path, {ROUTE_DYNAMIC, target.empty() ? target : Store_(target), handler, mayBlock, asyncHandler});
+}
+
+void Router::Add_(string_view method, string_view path, const Route& route)
+{
+    assert(!path.empty());
+    if((count_ + 1) * 2 > table_.size())
+        Rehash_(table_.size() * 2);
+    uint32_t hash = Hash_(path);
+    size_t mask = table_.size() - 1;
+    size_t i = hash & mask;
+    while(!table_[i].path.empty() && (table_[i].hash != hash || table_[i].path != path))
+        i = (i + 1) & mask;
+    Entry& entry = table_[i];
+    if(entry.path.empty())
+    {
+        entry.path = Store_(path);
+        entry.hash = hash;
+        entry.used = 0;
+        count_++;
+    }
+    int idx = MethodIndex_(method);
+    entry.routes[idx] = route;
+    entry.used |= 1 << idx;
+}
+
+const Router::Route* Router::Find(string_view method, string_view path) const
+{
+    if(path.empty())
+        return nullptr;
+    uint32_t hash = Hash_(path);
+    size_t mask = table_.size() - 1;
+    for(size_t i = hash & mask; !table_[i].path.empty(); i = (i + 1) & mask)
+    {
+        const Entry& entry = table_[i];
+        if(entry.hash != hash || entry.path != path)
+            continue;
+        int idx = MethodIndex_(method);
+        if(entry.used & (1 << idx))
+            return &entry.routes[idx];
+        if(entry.used & (1 << METHOD_ANY))
+            return &entry.routes[METHOD_ANY];
+        return nullptr;
+    }
+    return nullptr;
+}
+
+void Router::Rehash_(size_t size)
+{
+    vector<Entry> old(size);
+    old.swap(table_);
+    size_t mask = size - 1;
+    for(const Entry& entry : old)
+    {
+        if(entry.path.empty())
+            continue;
+        size_t i = entry.hash & mask;
+        while(!table_[i].path.empty())
+            i = (i + 1) & mask;
+        table_[i] = entry;
+    }
+}
+
+string_view Router::Store_(string_view str)
+{
+    strings_.emplace_back(str);
+    return strings_.back();
+}
+
+int Router::MethodIndex_(string_view method)
+{
+    if(method == "GET")
+        return METHOD_GET;
+    if(method == "POST")
+        return METHOD_POST;
+    return METHOD_ANY;
+}
+
+// FNV-1a
+uint32_t Router::Hash_(string_view path)
+{
+    uint32_t hash = 2166136261u;
+    for(char ch : path)
+    {
+        hash ^= static_cast<uint8_t>(ch);
+        hash *= 16777619u;
+    }
+    return hash;
+}
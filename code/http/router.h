@@ -0,0 +1,93 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <assert.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <functional>
+
+using namespace std;
+
+class HttpRequest;
+class AsyncSqlPool;
+
+// 路由表：按方法+路径精确匹配，目标分为静态文件、重写和动态处理三种
+// 每个路径占开放寻址哈希表的一个槽位，槽位内再按方法区分，查找只需一次哈希和一次比较，与路由数量无关
+// 路由在服务启动前注册，运行期间只读，查找不加锁
+class Router
+{
+public:
+    enum ROUTE_TYPE
+    {
+        ROUTE_STATIC,                               // 按原路径发送文件
+        ROUTE_REWRITE,                              // 换成target后发送文件
+        ROUTE_DYNAMIC,                              // 请求完整后调用handler，由它给出要发送的文件
+    };
+
+    enum ROUTE_METHOD
+    {
+        METHOD_GET,
+        METHOD_POST,
+        METHOD_ANY,                                 // 其余方法和"*"
+        METHOD_COUNT,
+    };
+
+    // 返回要发送的文件路径，返回空则保持target(或原路径)不变；返回的视图要在请求处理完之前一直有效
+    typedef string_view (*Handler)(const HttpRequest& request);
+
+    // 异步处理函数：在reactor线程中调用，不能阻塞，通过sql发起查询，完成后调用done(路径)，含义同Handler的返回值
+    typedef function<void(string_view path)> AsyncDone;
+    typedef void (*AsyncHandler)(const HttpRequest& request, AsyncSqlPool* sql, AsyncDone done);
+
+    struct Route
+    {
+        ROUTE_TYPE type;
+        string_view target;                         // 重写后的路径，动态路由中为调用handler之前的路径，可以为空
+        Handler handler;
+        bool mayBlock;                              // handler会阻塞(如查询数据库)，需要交给线程池
+        AsyncHandler asyncHandler;                  // 非空且服务器启用了异步数据库连接时代替handler
+    };
+
+    static Router* Instance();
+
+    Router();
+    ~Router() = default;
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    // method为"GET"/"POST"，其他方法或"*"对应METHOD_ANY；同一方法和路径重复注册时后面的覆盖前面的
+    void AddStatic(string_view method, string_view path);
+    void AddRewrite(string_view method, string_view path, string_view target);
+    void AddDynamic(string_view method, string_view path, Handler handler, bool mayBlock, string_view target = string_view(),
+                    AsyncHandler asyncHandler = nullptr);
+
+    // 先找该方法的路由，没有再找METHOD_ANY的；都没有返回nullptr
+    const Route* Find(string_view method, string_view path) const;
+    size_t Size() const { return count_; }
+
+private:
+    struct Entry
+    {
+        string_view path;                           // 为空表示空槽位
+        uint32_t hash;
+        uint8_t used;                               // 按位记录哪些方法注册了路由
+        Route routes[METHOD_COUNT];
+    };
+
+    void Add_(string_view method, string_view path, const Route& route);
+    void Rehash_(size_t size);
+    string_view Store_(string_view str);
+    static int MethodIndex_(string_view method);
+    static uint32_t Hash_(string_view path);
+
+    vector<Entry> table_;                           // 大小为2的幂，负载不超过1/2
+    size_t count_;                                  // 已用的槽位数(路径数)
+    deque<string> strings_;                         // 路径和target的存储，deque追加时不搬移已有元素
+
+    static const size_t INIT_SIZE = 64;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "urldecoder.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const int8_t UrlDecoder::HEX[256] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+size_t UrlDecoder::Decode(const char* src, size_t len, char* dst)
+{
+    static const DecodeFunc decode = Select_();
+    return decode(src, len, dst);
+}
+
+const char* UrlDecoder::Impl()
+{
+    DecodeFunc decode = Select_();
+    if(decode == DecodeAVX2_)
+        return "avx2";
+    if(decode == DecodeSSE2_)
+        return "sse2";
+    return "scalar";
+}
+
+size_t UrlDecoder::DecodeScalar(const char* src, size_t len, char* dst)
+{
+    size_t i = 0, j = 0;
+    DecodeRun_(src, i, len, len, dst, j);
+    return j;
+}
+
+// 循环里用局部变量，dst是char*，通过引用累加会让每写一个字节都重新读写i、j
+__attribute__((noinline))
+void UrlDecoder::DecodeRun_(const char* src, size_t& i, size_t end, size_t len, char* dst, size_t& j)
+{
+    size_t si = i, dj = j;
+    while(si < end)
+    {
+        if(src[si] == '%' || src[si] == '+')
+            si += DecodeSpecial_(src, si, len, dst, dj);
+        else
+            dst[dj] = src[si++];
+        dj++;
+    }
+    i = si;
+    j = dj;
+}
+
+// 处理一个含少量'%'的块：plain是'+'已换成空格的块内容，mask是块内'%'的位置
+// 两个转义之间的普通字节从plain整段复制，转义逐个解码；最后一个转义可能越过块尾
+// 返回消耗的源字节数，*j为dst中的写位置
+size_t UrlDecoder::DecodeChunk_(const char* src, size_t i, size_t len, const char* plain, unsigned mask,
+                                size_t width, char* dst, size_t* j)
+{
+    size_t pos = 0, dj = *j;
+    while(mask)
+    {
+        size_t p = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if(p < pos)                                 // 落在上一个转义里(只会是无效转义后的情况，保险起见)
+            continue;
+        memcpy(dst + dj, plain + pos, p - pos);
+        dj += p - pos;
+        pos = p + DecodeSpecial_(src, i + p, len, dst, dj);
+        dj++;
+    }
+    if(pos < width)
+    {
+        memcpy(dst + dj, plain + pos, width - pos);
+        dj += width - pos;
+        pos = width;
+    }
+    *j = dj;
+    return pos;
+}
+
+#if defined(__x86_64__)
+
+UrlDecoder::DecodeFunc UrlDecoder::Select_()
+{
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return DecodeAVX2_;
+    return DecodeSSE2_;                             // x86_64都支持SSE2
+}
+
+// 每次看16字节，先把'+'换成空格：没有'%'时整块写出，有'%'时按位置逐个处理
+// 原地解码时j <= i，整块写出只会覆盖已经读过的字节；含'%'的块先存到plain再分段复制
+size_t UrlDecoder::DecodeSSE2_(const char* src, size_t len, char* dst)
+{
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i space = _mm_set1_epi8(' ');
+    alignas(16) char plain[16];
+    size_t i = 0, j = 0;
+    while(i + 16 <= len)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i isPlus = _mm_cmpeq_epi8(chunk, plus);
+        chunk = _mm_or_si128(_mm_andnot_si128(isPlus, chunk), _mm_and_si128(isPlus, space));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, percent));
+        if(mask == 0)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), chunk);
+            i += 16;
+            j += 16;
+            continue;
+        }
+        if(__builtin_popcount(mask) > DENSE_ESCAPES)
+        {
+            // 转义很密时分段复制反而比标量慢，后面一段很可能也一样，整段交给标量循环
+            DecodeRun_(src, i, len - i > DENSE_RUN ? i + DENSE_RUN : len, len, dst, j);
+            continue;
+        }
+        _mm_store_si128(reinterpret_cast<__m128i*>(plain), chunk);
+        i += DecodeChunk_(src, i, len, plain, mask, 16, dst, &j);
+    }
+    return j + DecodeScalar(src + i, len - i, dst + j);
+}
+
+__attribute__((target("avx2")))
+size_t UrlDecoder::DecodeAVX2_(const char* src, size_t len, char* dst)
+{
+    const __m256i percent = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
+    const __m256i space = _mm256_set1_epi8(' ');
+    alignas(32) char plain[32];
+    size_t i = 0, j = 0;
+    while(i + 32 <= len)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        chunk = _mm256_blendv_epi8(chunk, space, _mm256_cmpeq_epi8(chunk, plus));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, percent));
+        if(mask == 0)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), chunk);
+            i += 32;
+            j += 32;
+            continue;
+        }
+        if(__builtin_popcount(mask) > DENSE_ESCAPES)
+        {
+            // 转义很密时分段复制反而比标量慢，后面一段很可能也一样，整段交给标量循环
+            DecodeRun_(src, i, len - i > DENSE_RUN ? i + DENSE_RUN : len, len, dst, j);
+            continue;
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(plain), chunk);
+        i += DecodeChunk_(src, i, len, plain, mask, 32, dst, &j);
+    }
+    return j + DecodeSSE2_(src + i, len - i, dst + j);
+}
+
+#else
+
+UrlDecoder::DecodeFunc UrlDecoder::Select_()
+{
+    return DecodeScalar;
+}
+
+size_t UrlDecoder::DecodeSSE2_(const char* src, size_t len, char* dst)
+{
+    return DecodeScalar(src, len, dst);
+}
+
+size_t UrlDecoder::DecodeAVX2_(const char* src, size_t len, char* dst)
+{
+    return DecodeScalar(src, len, dst);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef URL_DECODER_H
+#define URL_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// application/x-www-form-urlencoded 解码：'+'转空格，%XX转成对应字节，
+// 不合法的转义(非16进制、长度不够)原样保留
+// 普通字符用SSE2/AVX2一次扫描16/32字节，运行时按CPU选择，非x86平台只有标量实现
+class UrlDecoder
+{
+public:
+    // 把[src, src+len)解码到dst，返回解码后的长度；dst可以等于src(原地解码)，解码后不会变长
+    static size_t Decode(const char* src, size_t len, char* dst);
+    static size_t DecodeScalar(const char* src, size_t len, char* dst);
+    static const char* Impl();                      // 当前使用的实现，"avx2"/"sse2"/"scalar"
+
+private:
+    typedef size_t (*DecodeFunc)(const char* src, size_t len, char* dst);
+    static DecodeFunc Select_();
+    static size_t DecodeSSE2_(const char* src, size_t len, char* dst);
+    static size_t DecodeAVX2_(const char* src, size_t len, char* dst);
+    static size_t DecodeChunk_(const char* src, size_t i, size_t len, const char* plain, unsigned mask,
+                               size_t width, char* dst, size_t* j);
+
+    // 逐字节解码src[i, end)，最后一个转义可以越过end(不超过len)；结束时i、j为源和dst的下一个位置
+    // 不内联：向量实现转义密集时调用的和DecodeScalar是同一份代码
+    static void DecodeRun_(const char* src, size_t& i, size_t end, size_t len, char* dst, size_t& j);
+
+    // 处理src[i]处的'+'或'%'，写到dst[j]，返回消耗的源字节数
+    static size_t DecodeSpecial_(const char* src, size_t i, size_t len, char* dst, size_t j)
+    {
+        if(src[i] == '+')
+        {
+            dst[j] = ' ';
+            return 1;
+        }
+        int hi, lo;
+        if(i + 2 < len && (hi = HEX[(uint8_t)src[i + 1]]) >= 0 && (lo = HEX[(uint8_t)src[i + 2]]) >= 0)
+        {
+            dst[j] = static_cast<char>(hi << 4 | lo);
+            return 3;
+        }
+        dst[j] = '%';
+        return 1;
+    }
+
+    static const int8_t HEX[256];                   // 16进制字符对应的值，其余为-1
+    static const int DENSE_ESCAPES = 4;             // 一个块里超过这么多个'%'算转义密集
+    static const size_t DENSE_RUN = 4096;           // 转义密集时连续按标量处理的字节数，之后再回到向量扫描
+};
+
+#endif
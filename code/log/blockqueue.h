@@ -49,10 +49,11 @@ BlockQueue<T>::~BlockQueue() {
 
 template<typename T>
 void BlockQueue<T>::Close() {
-    // lock_guard<mutex> locker(mtx_); // 操控队列之前，都需要上锁
-    // deq_.clear();                   // 清空队列
-    clear();
-    isClose_ = true;
+    {
+        lock_guard<mutex> locker(mtx_); // 在锁内置位，等待中的pop()不会错过通知
+        deq_.clear();
+        isClose_ = true;
+    }
     condConsumer_.notify_all();
     condProducer_.notify_all();
 }
@@ -100,6 +101,9 @@ template<typename T>
 bool BlockQueue<T>::pop(T& item) {
     unique_lock<mutex> locker(mtx_);
     while(deq_.empty()) {
+        if(isClose_) {
+            return false;               // 关闭后返回，写线程才能退出
+        }
         condConsumer_.wait(locker);     // 队列空了，需要等待
     }
     item = deq_.front();
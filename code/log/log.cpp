@@ -11,11 +11,13 @@ Log::Log() {
 }
 
 Log::~Log() {
-    while(!deque_->empty()) {
-        deque_->flush();    // 唤醒消费者，处理掉剩下的任务
+    if(writeThread_ && writeThread_->joinable()) {  // 只有异步日志才有写线程
+        while(!deque_->empty()) {
+            deque_->flush();    // 唤醒消费者，处理掉剩下的任务
+        }
+        deque_->Close();    // 关闭队列
+        writeThread_->join();   // 等待当前线程完成手中的任务
     }
-    deque_->Close();    // 关闭队列
-    writeThread_->join();   // 等待当前线程完成手中的任务
     if(fp_) {       // 冲洗文件缓冲区，关闭文件描述符
         lock_guard<mutex> locker(mtx_);
         flush();        // 清空缓冲区中的数据
@@ -51,6 +53,13 @@ void Log::AsyncWrite_() {
     }
 }
 
+bool Log::SetAffinity(const cpu_set_t& set) {
+    if(!writeThread_) {
+        return false;
+    }
+    return pthread_setaffinity_np(writeThread_->native_handle(), sizeof(set), &set) == 0;
+}
+
 // 初始化日志实例
 void Log::init(int level, const char* path, const char* suffix, int maxQueCapacity) {
     isOpen_ = true;
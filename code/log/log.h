@@ -9,6 +9,7 @@
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         // mkdir
+#include <sched.h>            // cpu_set_t
 #include "blockqueue.h"
 #include "../buffer/buffer.h"
 
@@ -28,6 +29,7 @@ public:
     int GetLevel();
     void SetLevel(int level);
     bool IsOpen() { return isOpen_; }
+    bool SetAffinity(const cpu_set_t& set);    // 绑定异步写线程，同步日志时返回false
     
 private:
     Log();
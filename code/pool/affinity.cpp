@@ -0,0 +1,122 @@
+#include "affinity.h"
+
+using namespace std;
+
+// 解析/sys下"0-3,8-11"格式的CPU/节点列表，文件不存在返回空
+vector<int> Affinity::ParseCpuList_(const char* path) {
+    vector<int> list;
+    FILE* fp = fopen(path, "r");
+    if(!fp) {
+        return list;
+    }
+    int begin = 0, end = 0;
+    char sep = 0;
+    while(fscanf(fp, "%d", &begin) == 1) {
+        end = begin;
+        sep = fgetc(fp);
+        if(sep == '-') {
+            if(fscanf(fp, "%d", &end) != 1) {
+                break;
+            }
+            sep = fgetc(fp);
+        }
+        for(int i = begin; i <= end; i++) {
+            list.push_back(i);
+        }
+        if(sep != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return list;
+}
+
+// 拓扑只在第一次使用时读取
+const Affinity::Topology& Affinity::Topo_() {
+    static Topology topo = []() {
+        Topology t;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if(CPU_ISSET(cpu, &allowed)) {
+                    t.cpus.push_back(cpu);
+                }
+            }
+        }
+        char path[128] = {0};
+        for(int node : ParseCpuList_("/sys/devices/system/node/online")) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            vector<int> cpus;
+            for(int cpu : ParseCpuList_(path)) {
+                if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if(!cpus.empty()) {
+                t.nodeCpus.push_back(cpus);
+            }
+        }
+        if(t.nodeCpus.empty()) {        // 没有NUMA信息时当作单节点
+            t.nodeCpus.push_back(t.cpus);
+        }
+        return t;
+    }();
+    return topo;
+}
+
+bool Affinity::CpuSetFor(int mode, int index, cpu_set_t* set) {
+    const Topology& topo = Topo_();
+    if(mode == PIN_NONE || index < 0 || topo.cpus.empty()) {
+        return false;
+    }
+    CPU_ZERO(set);
+    if(mode == PIN_CORE) {
+        CPU_SET(topo.cpus[index % topo.cpus.size()], set);
+    } else {
+        for(int cpu : topo.nodeCpus[index % topo.nodeCpus.size()]) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return true;
+}
+
+bool Affinity::PinThread(int mode, int index) {
+    return PinThread(pthread_self(), mode, index);
+}
+
+bool Affinity::PinThread(pthread_t tid, int mode, int index) {
+    cpu_set_t set;
+    if(!CpuSetFor(mode, index, &set)) {
+        return false;
+    }
+    return pthread_setaffinity_np(tid, sizeof(set), &set) == 0;
+}
+
+int Affinity::NodeCount() {
+    return Topo_().nodeCpus.size();
+}
+
+int Affinity::CurrentNode() {
+    unsigned cpu = 0, node = 0;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) < 0) {
+        return 0;
+    }
+    return node;
+}
+
+bool Affinity::BindMemory(void* addr, size_t len, int node) {
+    if(NodeCount() <= 1 || node < 0 || node >= (int)(sizeof(unsigned long) * 8)) {
+        return false;
+    }
+    // mbind要求起始地址按页对齐，只处理完整落在区间内的页
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(addr) + page - 1) & ~(page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + len) & ~(page - 1);
+    if(begin >= end) {
+        return false;
+    }
+    unsigned long nodeMask = 1UL << node;
+    return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, &nodeMask,
+                   sizeof(nodeMask) * 8, MPOL_MF_MOVE) == 0;
+}
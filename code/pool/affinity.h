@@ -0,0 +1,42 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+// 线程绑核/绑NUMA节点以及内存迁移到指定节点
+// 直接读/sys和调用sched_setaffinity、mbind，不依赖libnuma
+class Affinity {
+public:
+    enum PIN_MODE {
+        PIN_NONE,
+        PIN_CORE,       // 第index个线程绑到第index个可用CPU(取模)
+        PIN_NODE,       // 第index个线程绑到第index个NUMA节点的全部CPU(取模)
+    };
+
+    // 按mode和线程序号计算CPU集合，PIN_NONE或拓扑不可用时返回false
+    static bool CpuSetFor(int mode, int index, cpu_set_t* set);
+    static bool PinThread(int mode, int index);                 // 绑定当前线程
+    static bool PinThread(pthread_t tid, int mode, int index);
+
+    static int NodeCount();
+    static int CurrentNode();                                   // 当前线程所在CPU的节点
+    static bool BindMemory(void* addr, size_t len, int node);   // 把已分配的内存迁到node上，之后缺页也从node分配
+
+private:
+    struct Topology {
+        std::vector<int> cpus;                      // 进程可用的CPU
+        std::vector<std::vector<int>> nodeCpus;     // 每个节点上进程可用的CPU
+    };
+
+    static const Topology& Topo_();
+    static std::vector<int> ParseCpuList_(const char* path);
+};
+
+#endif
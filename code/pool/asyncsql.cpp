@@ -0,0 +1,327 @@
+#include "asyncsql.h"
+
+AsyncSqlPool::AsyncSqlPool(Watcher watcher) : watcher_(std::move(watcher)), port_(0), alive_(0), sharedCount_(0) {
+    assert(watcher_);
+}
+
+AsyncSqlPool::~AsyncSqlPool() {
+    ClosePool();
+}
+
+#ifdef MYSQL_WAIT_READ
+
+static_assert(MYSQL_WAIT_READ == AsyncSqlPool::WAIT_READ && MYSQL_WAIT_WRITE == AsyncSqlPool::WAIT_WRITE &&
+              MYSQL_WAIT_EXCEPT == AsyncSqlPool::WAIT_EXCEPT && MYSQL_WAIT_TIMEOUT == AsyncSqlPool::WAIT_TIMEOUT,
+              "wait events mismatch");
+
+bool AsyncSqlPool::Supported() {
+    return true;
+}
+
+bool AsyncSqlPool::Init(const char* host, int port,
+                        const char* user, const char* pwd,
+                        const char* dbName, int connSize) {
+    assert(connSize > 0 && conns_.empty());
+    host_ = host;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    port_ = port;
+    conns_.reserve(connSize);
+    for(int i = 0; i < connSize; i++) {
+        MYSQL* sql = mysql_init(nullptr);
+        if(!sql) {
+            LOG_ERROR("MySql init error!");
+            break;
+        }
+        Options_(sql);
+        if(!mysql_real_connect(sql, host, user, pwd, dbName, port, nullptr, 0)) {
+            LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+            mysql_close(sql);
+            break;
+        }
+        conns_.push_back({sql, mysql_get_socket(sql), STAGE_IDLE, false, 0, 0, nullptr, nullptr, Clock::time_point(), Task()});
+    }
+    if((int)conns_.size() < connSize) {
+        ClosePool();
+        return false;
+    }
+    for(auto& conn : conns_) {
+        idle_.push_back(&conn);
+    }
+    alive_ = connSize;
+    return true;
+}
+
+// 读写超时让卡住的语句以WAIT_TIMEOUT结束，不会一直占着连接
+void AsyncSqlPool::Options_(MYSQL* sql) {
+    unsigned int timeout = TIMEOUT_S;
+    mysql_options(sql, MYSQL_OPT_NONBLOCK, 0);
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    mysql_options(sql, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(sql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+}
+
+bool AsyncSqlPool::Available() {
+    Revive_();
+    return alive_ > 0;
+}
+
+void AsyncSqlPool::Query(std::string sql, bool share, Callback cb) {
+    assert(cb);
+    Revive_();
+    if(alive_ == 0) {
+        cb(nullptr, false);
+        return;
+    }
+    if(share) {
+        auto it = waiters_.find(sql);
+        if(it != waiters_.end()) {
+            it->second.push_back(std::move(cb));
+            sharedCount_++;
+            return;
+        }
+        waiters_.emplace(sql, std::vector<Callback>());
+    }
+    Task task = {std::move(sql), std::move(cb), share};
+    if(idle_.empty()) {
+        queue_.push_back(std::move(task));
+        return;
+    }
+    Conn* conn = idle_.back();
+    idle_.pop_back();
+    Start_(conn, std::move(task));
+}
+
+void AsyncSqlPool::Start_(Conn* conn, Task&& task) {
+    conn->task = std::move(task);
+    conn->stage = STAGE_QUERY;
+    conn->res = nullptr;
+    int status = mysql_real_query_start(&conn->err, conn->sql, conn->task.sql.data(), conn->task.sql.size());
+    Step_(conn, status);
+}
+
+// 执行语句，再取结果集；两步都可能需要等待socket，由OnEvent()带着就绪的事件回到这里
+void AsyncSqlPool::Step_(Conn* conn, int status) {
+    while(status == 0) {
+        if(conn->stage == STAGE_CONNECT) {
+            Connected_(conn);
+            return;
+        }
+        if(conn->stage == STAGE_STORE || conn->err) {
+            // 没有结果集的语句(INSERT等)mysql_field_count为0，不算出错
+            Finish_(conn, !conn->err && (conn->res || mysql_field_count(conn->sql) == 0));
+            return;
+        }
+        conn->stage = STAGE_STORE;
+        status = mysql_store_result_start(&conn->res, conn->sql);
+    }
+    conn->wait = status;
+    watcher_(conn->fd, status, (status & WAIT_TIMEOUT) ? (int)mysql_get_timeout_value_ms(conn->sql) : 0);
+}
+
+void AsyncSqlPool::OnEvent(int fd, int events) {
+    Conn* conn = Find_(fd);
+    if(!conn || conn->stage == STAGE_IDLE) {
+        return;                             // 空闲连接上的挂断等事件，下次执行语句时再发现
+    }
+    if((events & WAIT_TIMEOUT) && !(conn->wait & WAIT_TIMEOUT)) {
+        return;                             // 上一次等待留下的定时器
+    }
+    conn->wait = 0;
+    int status;
+    if(conn->stage == STAGE_CONNECT) {
+        status = mysql_real_connect_cont(&conn->connected, conn->sql, events);
+    } else if(conn->stage == STAGE_QUERY) {
+        status = mysql_real_query_cont(&conn->err, conn->sql, events);
+    } else {
+        status = mysql_store_result_cont(&conn->res, conn->sql, events);
+    }
+    Step_(conn, status);
+}
+
+// 先把连接放回去再调用回调，回调里发起的查询可以直接用上
+void AsyncSqlPool::Finish_(Conn* conn, bool ok) {
+    watcher_(conn->fd, 0, 0);
+    Task task = std::move(conn->task);
+    MYSQL_RES* res = conn->res;
+    conn->res = nullptr;
+    conn->stage = STAGE_IDLE;
+    if(!ok) {
+        unsigned int code = mysql_errno(conn->sql);
+        LOG_ERROR("MySql query error %u: %s", code, mysql_error(conn->sql));
+        if(code == 2006 || code == 2013) {  // CR_SERVER_GONE_ERROR, CR_SERVER_LOST，超时也是后者
+            conn->broken = true;
+            conn->retryAt = Clock::now();   // 下次需要连接时重连
+            alive_--;
+        }
+    }
+    if(!conn->broken) {
+        idle_.push_back(conn);
+    }
+    Dispatch_();
+    if(alive_ == 0) {                       // 连接全部断开，排队的请求直接失败
+        while(!queue_.empty()) {
+            Task failed = std::move(queue_.front());
+            queue_.pop_front();
+            Complete_(failed, nullptr, false);
+        }
+    }
+    Complete_(task, res, ok);
+    if(res) {
+        mysql_free_result(res);
+    }
+}
+
+// 排队的任务按先来先服务取走空闲连接
+void AsyncSqlPool::Dispatch_() {
+    while(!queue_.empty() && !idle_.empty()) {
+        Conn* next = idle_.back();
+        idle_.pop_back();
+        Task queued = std::move(queue_.front());
+        queue_.pop_front();
+        Start_(next, std::move(queued));
+    }
+}
+
+// 到了重试时间的断开连接开始重连，重连期间仍算断开
+void AsyncSqlPool::Revive_() {
+    if(alive_ == (int)conns_.size()) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    for(auto& conn : conns_) {
+        if(conn.broken && conn.stage == STAGE_IDLE && now >= conn.retryAt) {
+            Reconnect_(&conn);
+        }
+    }
+}
+
+// 旧连接关闭后socket随之从epoll中移除，新socket由watcher注册
+void AsyncSqlPool::Reconnect_(Conn* conn) {
+    if(conn->sql) {
+        mysql_close(conn->sql);
+    }
+    conn->fd = -1;
+    conn->sql = mysql_init(nullptr);
+    if(!conn->sql) {
+        LOG_ERROR("MySql init error!");
+        conn->retryAt = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+        return;
+    }
+    Options_(conn->sql);
+    conn->stage = STAGE_CONNECT;
+    conn->connected = nullptr;
+    int status = mysql_real_connect_start(&conn->connected, conn->sql, host_.c_str(), user_.c_str(), pwd_.c_str(),
+                                          dbName_.c_str(), port_, nullptr, 0);
+    conn->fd = mysql_get_socket(conn->sql);
+    Step_(conn, status);
+}
+
+void AsyncSqlPool::Connected_(Conn* conn) {
+    if(conn->fd >= 0) {
+        watcher_(conn->fd, 0, 0);
+    }
+    conn->stage = STAGE_IDLE;
+    if(!conn->connected) {
+        LOG_WARN("MySql reconnect error: %s", mysql_error(conn->sql));
+        conn->fd = -1;
+        conn->retryAt = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+        return;
+    }
+    LOG_INFO("MySql async connection reconnected");
+    conn->fd = mysql_get_socket(conn->sql);
+    conn->broken = false;
+    alive_++;
+    idle_.push_back(conn);
+    Dispatch_();
+}
+
+// 先摘下合并进来的回调，回调里再提交相同的语句会重新执行；每个回调都从结果集的第一行开始读
+void AsyncSqlPool::Complete_(Task& task, MYSQL_RES* res, bool ok) {
+    std::vector<Callback> waiters;
+    if(task.shared) {
+        auto it = waiters_.find(task.sql);
+        assert(it != waiters_.end());
+        waiters.swap(it->second);
+        waiters_.erase(it);
+    }
+    task.cb(res, ok);
+    for(auto& cb : waiters) {
+        if(res) {
+            mysql_data_seek(res, 0);
+        }
+        cb(res, ok);
+    }
+}
+
+#else
+
+bool AsyncSqlPool::Supported() {
+    return false;
+}
+
+bool AsyncSqlPool::Init(const char*, int, const char*, const char*, const char*, int) {
+    LOG_WARN("MySql client library has no non-blocking API");
+    return false;
+}
+
+bool AsyncSqlPool::Available() {
+    return false;
+}
+
+void AsyncSqlPool::Query(std::string, bool, Callback cb) {
+    cb(nullptr, false);
+}
+
+void AsyncSqlPool::OnEvent(int, int) {
+}
+
+#endif
+
+// 断开的连接也可以用来转义，只有重连时mysql_init失败的没有句柄
+std::string AsyncSqlPool::Escape(std::string_view str) const {
+    for(auto& conn : conns_) {
+        if(conn.sql) {
+            std::string out(str.size() * 2 + 1, '\0');
+            out.resize(mysql_real_escape_string(conn.sql, &out[0], str.data(), str.size()));
+            return out;
+        }
+    }
+    return std::string(str);
+}
+
+std::vector<int> AsyncSqlPool::Fds() const {
+    std::vector<int> fds;
+    for(auto& conn : conns_) {
+        if(conn.fd >= 0) {
+            fds.push_back(conn.fd);
+        }
+    }
+    return fds;
+}
+
+AsyncSqlPool::Conn* AsyncSqlPool::Find_(int fd) {
+    for(auto& conn : conns_) {
+        if(fd >= 0 && conn.fd == fd) {
+            return &conn;
+        }
+    }
+    return nullptr;
+}
+
+void AsyncSqlPool::ClosePool() {
+    for(auto& conn : conns_) {
+        if(conn.res) {
+            mysql_free_result(conn.res);
+        }
+        if(conn.sql) {
+            mysql_close(conn.sql);
+        }
+    }
+    conns_.clear();
+    idle_.clear();
+    queue_.clear();
+    waiters_.clear();
+    alive_ = 0;
+}
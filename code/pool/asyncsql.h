@@ -0,0 +1,113 @@
+#ifndef ASYNCSQL_H
+#define ASYNCSQL_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include "../log/log.h"
+
+// 基于MariaDB Connector/C非阻塞接口的数据库连接池，每个reactor一个，只在所属reactor线程中使用，不加锁
+// 语句执行期间连接的socket由reactor监听，就绪后调用OnEvent()继续执行，等待数据库时不占用线程
+// 客户端库没有非阻塞接口(没有定义MYSQL_WAIT_READ，如Oracle的libmysqlclient)时Init()返回false，
+// 由调用者回退到线程池+SqlConnPool
+// 断开的连接在下次需要连接时非阻塞地重连，失败后隔RETRY_MS再试；语句读写超过TIMEOUT_S秒按断开处理
+class AsyncSqlPool {
+public:
+    // 等待的事件，取值与MYSQL_WAIT_*相同
+    enum WAIT_EVENT {
+        WAIT_READ = 1,
+        WAIT_WRITE = 2,
+        WAIT_EXCEPT = 4,
+        WAIT_TIMEOUT = 8,
+    };
+
+    // res为结果集，没有结果集的语句为nullptr，回调返回后释放；ok为false表示执行出错
+    typedef std::function<void(MYSQL_RES* res, bool ok)> Callback;
+    // 由reactor提供：开始监听fd上的events(WAIT_EVENT的组合)，只需要触发一次，events为0表示不再监听
+    // 含WAIT_TIMEOUT时timeoutMS毫秒后以WAIT_TIMEOUT调用OnEvent()，过期的定时器不必取消；重连后fd会变成新的socket
+    typedef std::function<void(int fd, int events, int timeoutMS)> Watcher;
+
+    explicit AsyncSqlPool(Watcher watcher);
+    ~AsyncSqlPool();
+
+    // 启动时阻塞地建立连接
+    bool Init(const char* host, int port,
+              const char* user, const char* pwd,
+              const char* dbName, int connSize);
+    void ClosePool();
+
+    std::vector<int> Fds() const;           // 所有连接的socket，供reactor注册
+    // 有可用的连接；没有时由调用者改走阻塞的SqlConnPool，同时开始重连
+    bool Available();
+    size_t QueueSize() const { return queue_.size(); }
+    uint64_t SharedCount() const { return sharedCount_; }  // 合并掉的语句数
+
+    void Query(std::string sql, Callback cb) { Query(std::move(sql), false, std::move(cb)); }
+    // 没有空闲连接时按FIFO排队；回调可以再次调用Query
+    // share为true时与还没完成的相同语句(同样以share提交)合并，只执行一次，结果集依次交给各个回调
+    void Query(std::string sql, bool share, Callback cb);
+    void OnEvent(int fd, int events);           // fd上等待的事件就绪
+    std::string Escape(std::string_view str) const; // 按连接的字符集转义，用于拼接到语句的引号中
+
+    static bool Supported();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum STAGE {
+        STAGE_IDLE,
+        STAGE_CONNECT,                      // 断开后正在重连
+        STAGE_QUERY,
+        STAGE_STORE,
+    };
+
+    struct Task {
+        std::string sql;
+        Callback cb;
+        bool shared;
+    };
+
+    struct Conn {
+        MYSQL* sql;
+        int fd;
+        STAGE stage;
+        bool broken;                        // 连接已断开，重连成功前不再使用
+        int err;                            // mysql_real_query的返回值
+        int wait;                           // 正在等待的事件
+        MYSQL_RES* res;
+        MYSQL* connected;                   // mysql_real_connect的返回值
+        Clock::time_point retryAt;          // 重连失败后下次重连的时间
+        Task task;
+    };
+
+    void Options_(MYSQL* sql);
+    void Start_(Conn* conn, Task&& task);
+    void Step_(Conn* conn, int status);     // status为库返回的等待事件，0表示当前阶段完成
+    void Finish_(Conn* conn, bool ok);
+    void Dispatch_();
+    void Revive_();
+    void Reconnect_(Conn* conn);
+    void Connected_(Conn* conn);
+    void Complete_(Task& task, MYSQL_RES* res, bool ok);
+    Conn* Find_(int fd);
+
+    Watcher watcher_;
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+    std::vector<Conn> conns_;               // Init后大小不变，元素地址稳定
+    std::vector<Conn*> idle_;
+    std::deque<Task> queue_;
+    std::unordered_map<std::string, std::vector<Callback>> waiters_;    // 以share提交且未完成的语句 -> 合并进来的回调
+    int alive_;
+    uint64_t sharedCount_;
+
+    static constexpr unsigned int TIMEOUT_S = 5;
+    static constexpr int RETRY_MS = 1000;
+};
+
+#endif // ASYNCSQL_H
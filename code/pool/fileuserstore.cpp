@@ -0,0 +1,259 @@
+#include "fileuserstore.h"
+#include "siphash.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <random>
+
+const char FileUserStore::MAGIC[8] = {'T', 'W', 'S', 'U', 'S', 'E', 'R', '1'};
+
+bool FileUserStore::Open(const char* path, size_t capacity) {
+    std::unique_lock<std::shared_mutex> locker(mtx_);
+    Unmap_();
+    size_t slots = 64;
+    while(slots < capacity) {
+        slots <<= 1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        LOG_ERROR("Open user store %s error: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    bool create = (fstat(fd, &st) == 0 && st.st_size == 0);
+    if(!create) {
+        Header header;
+        if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) ||
+           header.capacity == 0 || (header.capacity & (header.capacity - 1)) ||
+           (uint64_t)st.st_size != sizeof(Header) + header.capacity * sizeof(Record)) {
+            LOG_ERROR("User store %s is not a valid file", path);
+            close(fd);
+            return false;
+        }
+        slots = header.capacity;
+    }
+    if(!Map_(fd, slots, create, nullptr)) {
+        close(fd);
+        return false;
+    }
+    path_ = path;
+    if(!create) {                           // 计数可能因为上次中途退出少加了一次
+        uint64_t count = 0;
+        for(size_t i = 0; i <= mask_; i++) {
+            count += (records_[i].hash != 0);
+        }
+        header_->count = count;
+    }
+    LOG_INFO("User store %s: %llu users, %zu slots", path, (unsigned long long)header_->count, mask_ + 1);
+    return true;
+}
+
+// create时写入头部，key为空则随机生成密钥
+bool FileUserStore::Map_(int fd, size_t capacity, bool create, const uint64_t* key) {
+    size_t len = sizeof(Header) + capacity * sizeof(Record);
+    if(create && ftruncate(fd, len) < 0) {
+        LOG_ERROR("Resize user store error: %s", strerror(errno));
+        return false;
+    }
+    void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        LOG_ERROR("Map user store error: %s", strerror(errno));
+        return false;
+    }
+    fd_ = fd;
+    base_ = static_cast<char*>(base);
+    mapLen_ = len;
+    header_ = reinterpret_cast<Header*>(base_);
+    records_ = reinterpret_cast<Record*>(base_ + sizeof(Header));
+    mask_ = capacity - 1;
+    if(create) {
+        memcpy(header_->magic, MAGIC, sizeof(MAGIC));
+        header_->capacity = capacity;
+        header_->count = 0;
+        if(key) {
+            header_->key[0] = key[0];
+            header_->key[1] = key[1];
+        } else {
+            std::random_device rd;
+            header_->key[0] = (static_cast<uint64_t>(rd()) << 32) | rd();
+            header_->key[1] = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+    }
+    return true;
+}
+
+void FileUserStore::Unmap_() {
+    if(base_) {
+        munmap(base_, mapLen_);
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = -1;
+    base_ = nullptr;
+    mapLen_ = 0;
+    header_ = nullptr;
+    records_ = nullptr;
+    mask_ = 0;
+}
+
+void FileUserStore::Close() {
+    std::unique_lock<std::shared_mutex> locker(mtx_);
+    Unmap_();
+}
+
+size_t FileUserStore::Size() const {
+    std::shared_lock<std::shared_mutex> locker(mtx_);
+    return header_ ? header_->count : 0;
+}
+
+uint64_t FileUserStore::Hash_(std::string_view name) const {
+    SipHash hash(header_->key[0], header_->key[1]);
+    hash.Update(name.data(), name.size());
+    uint64_t h = hash.Final();
+    return h ? h : 1;
+}
+
+// 负载不超过一半，一定能找到空槽位
+FileUserStore::Record* FileUserStore::Probe_(std::string_view name, uint64_t hash) const {
+    for(size_t i = hash & mask_; ; i = (i + 1) & mask_) {
+        Record* record = &records_[i];
+        if(record->hash == 0 || (record->hash == hash && record->nameLen == name.size() &&
+                                 memcmp(record->name, name.data(), name.size()) == 0)) {
+            return record;
+        }
+    }
+}
+
+UserStore::RESULT FileUserStore::Find(std::string_view name, std::string* pwd) {
+    std::shared_lock<std::shared_mutex> locker(mtx_);
+    if(!records_) {
+        return FAILED;
+    }
+    if(name.size() > MAX_LEN) {
+        return NOT_FOUND;
+    }
+    const Record* record = Probe_(name, Hash_(name));
+    if(record->hash == 0) {
+        return NOT_FOUND;
+    }
+    pwd->assign(record->pwd, record->pwdLen);
+    return OK;
+}
+
+UserStore::RESULT FileUserStore::Insert(std::string_view name, std::string_view pwd, bool) {
+    if(name.size() > MAX_LEN || pwd.size() > MAX_LEN) {
+        LOG_WARN("User name or password longer than %zu bytes", MAX_LEN);
+        return FAILED;
+    }
+    std::unique_lock<std::shared_mutex> locker(mtx_);
+    if(!records_) {
+        return FAILED;
+    }
+    uint64_t hash = Hash_(name);
+    Record* record = Probe_(name, hash);
+    if(record->hash != 0) {
+        return EXISTS;
+    }
+    if((header_->count + 1) * 2 > header_->capacity) {
+        if(!Grow_()) {
+            return FAILED;
+        }
+        record = Probe_(name, hash);
+    }
+    record->nameLen = name.size();
+    record->pwdLen = pwd.size();
+    memcpy(record->name, name.data(), name.size());
+    memcpy(record->pwd, pwd.data(), pwd.size());
+    __atomic_store_n(&record->hash, hash, __ATOMIC_RELEASE);   // 最后写哈希，记录才算存在
+    header_->count++;
+    return OK;
+}
+
+// 写一个两倍大小的新文件，rename到原路径上；失败时保留原文件
+bool FileUserStore::Grow_() {
+    std::string tmp = path_ + ".tmp";
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        LOG_ERROR("Open %s error: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    int oldFd = fd_;
+    char* oldBase = base_;
+    size_t oldLen = mapLen_;
+    Header* oldHeader = header_;
+    Record* oldRecords = records_;
+    size_t oldMask = mask_;
+    auto restore = [&]() {
+        fd_ = oldFd;
+        base_ = oldBase;
+        mapLen_ = oldLen;
+        header_ = oldHeader;
+        records_ = oldRecords;
+        mask_ = oldMask;
+    };
+    if(!Map_(fd, (oldMask + 1) * 2, true, oldHeader->key)) {
+        close(fd);
+        unlink(tmp.c_str());
+        restore();
+        return false;
+    }
+    for(size_t i = 0; i <= oldMask; i++) {
+        const Record& record = oldRecords[i];
+        if(record.hash != 0) {
+            *Probe_(std::string_view(record.name, record.nameLen), record.hash) = record;
+        }
+    }
+    header_->count = oldHeader->count;
+    // 新文件的内容和长度先落盘，否则断电后rename可能已生效而数据没有，整张表就丢了
+    if(msync(base_, mapLen_, MS_SYNC) < 0 || fsync(fd) < 0) {
+        LOG_ERROR("Sync %s error: %s", tmp.c_str(), strerror(errno));
+        Unmap_();
+        unlink(tmp.c_str());
+        restore();
+        return false;
+    }
+    if(rename(tmp.c_str(), path_.c_str()) < 0) {
+        LOG_ERROR("Rename %s error: %s", tmp.c_str(), strerror(errno));
+        Unmap_();
+        unlink(tmp.c_str());
+        restore();
+        return false;
+    }
+    SyncDir_();                                     // 失败时新文件已经生效，只是rename可能没落盘
+    munmap(oldBase, oldLen);
+    close(oldFd);
+    LOG_INFO("User store grows to %zu slots", mask_ + 1);
+    return true;
+}
+
+bool FileUserStore::SyncDir_() const {
+    size_t slash = path_.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0 || fsync(fd) < 0) {
+        LOG_WARN("Sync dir %s error: %s", dir.c_str(), strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+bool FileUserStore::ForEach(const std::function<void(std::string_view name)>& fn) {
+    std::shared_lock<std::shared_mutex> locker(mtx_);
+    if(!records_) {
+        return false;
+    }
+    for(size_t i = 0; i <= mask_; i++) {
+        if(records_[i].hash != 0) {
+            fn(std::string_view(records_[i].name, records_[i].nameLen));
+        }
+    }
+    return true;
+}
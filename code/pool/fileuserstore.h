@@ -0,0 +1,75 @@
+#ifndef FILEUSERSTORE_H
+#define FILEUSERSTORE_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <shared_mutex>
+#include "userstore.h"
+
+// 嵌入式引擎：用户表存在本地文件里，整个文件mmap到内存，按用户名的SipHash开放寻址查找，没有网络往返
+// 文件由头部和定长槽位组成，槽位数为2的幂；负载超过一半时写一个两倍大小的新文件再rename替换
+// 写入时先写内容再写哈希，进程中途退出不会留下半条记录；打开时重新数一遍用户数
+// 扩容时新文件落盘后才rename，再fsync所在目录，断电后看到的是完整的旧文件或新文件；
+// 单条插入不主动落盘，断电可能丢失最近插入的用户
+// 查找持读锁，插入持写锁；同一个文件只能由一个进程打开
+class FileUserStore : public UserStore {
+public:
+    FileUserStore() = default;
+    ~FileUserStore() override { Close(); }
+    FileUserStore(const FileUserStore&) = delete;
+    FileUserStore& operator=(const FileUserStore&) = delete;
+
+    // 文件不存在时按capacity个槽位创建
+    bool Open(const char* path, size_t capacity = DEFAULT_CAPACITY);
+    void Close();
+    size_t Size() const;
+
+    const char* Name() const override { return "file"; }
+    RESULT Find(std::string_view name, std::string* pwd) override;
+    RESULT Insert(std::string_view name, std::string_view pwd, bool absent) override;
+    bool ForEach(const std::function<void(std::string_view name)>& fn) override;
+    bool Remote() const override { return false; }
+
+    static const size_t MAX_LEN = 59;               // 用户名和密码的最大字节数
+    static const size_t DEFAULT_CAPACITY = 1 << 16;
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t capacity;                          // 槽位数
+        uint64_t count;
+        uint64_t key[2];                            // SipHash密钥，建文件时随机生成
+        char reserved[24];
+    };
+
+    struct Record {
+        uint64_t hash;                              // 0表示空槽位
+        uint8_t nameLen;
+        uint8_t pwdLen;
+        char name[MAX_LEN];
+        char pwd[MAX_LEN];
+    };
+
+    static_assert(sizeof(Header) == 64 && sizeof(Record) == 128, "file layout");
+
+    bool Map_(int fd, size_t capacity, bool create, const uint64_t* key);
+    void Unmap_();
+    bool Grow_();
+    bool SyncDir_() const;                          // rename后让目录项落盘
+    Record* Probe_(std::string_view name, uint64_t hash) const;     // 找到的记录或应插入的空槽位
+    uint64_t Hash_(std::string_view name) const;
+
+    std::string path_;
+    int fd_ = -1;
+    char* base_ = nullptr;
+    size_t mapLen_ = 0;
+    Header* header_ = nullptr;
+    Record* records_ = nullptr;
+    size_t mask_ = 0;
+    mutable std::shared_mutex mtx_;
+
+    static const char MAGIC[8];
+};
+
+#endif // FILEUSERSTORE_H
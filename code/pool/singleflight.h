@@ -0,0 +1,76 @@
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// 合并并发的相同调用：同一个key同时只有第一个调用者(leader)执行fn，其余调用者阻塞等待并拿到同一个结果
+// 结果不缓存，leader返回后下一次调用重新执行；用于多个线程同时为同一个用户名查库的情况
+template<typename T>
+class SingleFlight {
+public:
+    SingleFlight() : calls_(0), shared_(0) {}
+
+    // shared非空时返回本次是否用的是别人的结果
+    template<typename Fn>
+    T Do(std::string_view key, Fn&& fn, bool* shared = nullptr) {
+        calls_++;
+        std::shared_ptr<Call> call;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            auto it = inflight_.find(std::string(key));
+            if(it == inflight_.end()) {
+                call = std::make_shared<Call>();
+                inflight_.emplace(std::string(key), call);
+                leader = true;
+            } else {
+                call = it->second;
+            }
+        }
+        if(shared) {
+            *shared = !leader;
+        }
+        if(!leader) {
+            shared_++;
+            std::unique_lock<std::mutex> locker(call->mtx);
+            call->cond.wait(locker, [&call] { return call->done; });
+            return call->val;
+        }
+        T val = fn();
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            inflight_.erase(std::string(key));         // 之后的调用者重新执行
+        }
+        {
+            std::lock_guard<std::mutex> locker(call->mtx);
+            call->val = val;
+            call->done = true;
+        }
+        call->cond.notify_all();
+        return val;
+    }
+
+    uint64_t Calls() const { return calls_; }
+    uint64_t Shared() const { return shared_; }        // 等待别人结果的次数，即省掉的执行次数
+
+private:
+    struct Call {
+        std::mutex mtx;
+        std::condition_variable cond;
+        bool done = false;
+        T val;
+    };
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::shared_ptr<Call>> inflight_;
+    std::atomic<uint64_t> calls_;
+    std::atomic<uint64_t> shared_;
+};
+
+#endif // SINGLEFLIGHT_H
@@ -0,0 +1,58 @@
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// SipHash-2-4：带密钥的64位哈希，可以分几段输入；用户名由客户端决定，不带密钥的哈希可以被刻意构造碰撞
+class SipHash {
+public:
+    SipHash(uint64_t k0, uint64_t k1)
+        : v0_(0x736f6d6570736575ULL ^ k0), v1_(0x646f72616e646f6dULL ^ k1),
+          v2_(0x6c7967656e657261ULL ^ k0), v3_(0x7465646279746573ULL ^ k1), word_(0), total_(0) {}
+
+    void Update(const void* data, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for(size_t i = 0; i < len; i++) {
+            word_ |= static_cast<uint64_t>(bytes[i]) << (8 * (total_ & 7));
+            if((++total_ & 7) == 0) {
+                Compress_(word_);
+                word_ = 0;
+            }
+        }
+    }
+
+    uint64_t Final() {
+        Compress_(word_ | (static_cast<uint64_t>(total_ & 0xff) << 56));
+        v2_ ^= 0xff;
+        for(int i = 0; i < 4; i++) {
+            Round_();
+        }
+        return v0_ ^ v1_ ^ v2_ ^ v3_;
+    }
+
+private:
+    static uint64_t Rotl_(uint64_t x, int b) {
+        return (x << b) | (x >> (64 - b));
+    }
+
+    void Round_() {
+        v0_ += v1_; v1_ = Rotl_(v1_, 13); v1_ ^= v0_; v0_ = Rotl_(v0_, 32);
+        v2_ += v3_; v3_ = Rotl_(v3_, 16); v3_ ^= v2_;
+        v0_ += v3_; v3_ = Rotl_(v3_, 21); v3_ ^= v0_;
+        v2_ += v1_; v1_ = Rotl_(v1_, 17); v1_ ^= v2_; v2_ = Rotl_(v2_, 32);
+    }
+
+    void Compress_(uint64_t m) {
+        v3_ ^= m;
+        Round_();
+        Round_();
+        v0_ ^= m;
+    }
+
+    uint64_t v0_, v1_, v2_, v3_;
+    uint64_t word_;                         // 未满8字节的部分
+    size_t total_;
+};
+
+#endif // SIPHASH_H
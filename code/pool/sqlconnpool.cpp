@@ -1,66 +1,373 @@
 #include "sqlconnpool.h"
+#include <algorithm>
 #include <mysql/mysql.h>
 #include <mysql/client_plugin.h>
 
+thread_local SqlConnPool::Lease SqlConnPool::lease_;
+
 SqlConnPool* SqlConnPool::Instance() {
     static SqlConnPool pool;
     return &pool;
 }
 
+void SqlConnPool::BindThread() {
+    lease_.bound = true;
+}
+
+SqlConnPool::Lease::~Lease() {
+    if(conn && epoch == pool->epoch_.load(std::memory_order_relaxed)) {
+        pool->Unlease_(*this);
+    }
+}
+
 // 初始化
 void SqlConnPool::Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize = 10) {
+              const char* user,const char* pwd,
+              const char* dbName, int connSize, int maxSize, int timeoutMS) {
     assert(connSize > 0);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        // 租约和取出的连接一样要先还回来：持有租约的线程随时可能在用它，不能在这里关掉
+        assert(busy_ == 0 && leased_ == 0 && waiters_.empty());
+        for(int idx : idle_) {
+            Close_(idx);
+        }
+        epoch_++;
+        host_ = host;
+        user_ = user;
+        pwd_ = pwd;
+        dbName_ = dbName;
+        port_ = port;
+        minSize_ = connSize;
+        maxSize_ = std::max(connSize, maxSize);
+        timeoutMS_ = timeoutMS;
+        closing_ = false;
+        libraryUp_ = true;
+        slots_.reset(new Slot[maxSize_]);
+        idle_.clear();
+        closed_.clear();
+        for(int i = maxSize_ - 1; i >= 0; i--) {
+            closed_.push_back(i);
+        }
+        open_ = busy_ = peakBusy_ = leased_ = 0;
+        acquires_ = waits_ = timeouts_ = waitUs_ = maxWaitUs_ = grows_ = shrinks_ = 0;
+        reconnects_ = 0;
+    }
+    // 建立失败的槽位留在closed_里，之后取连接时补上
     for(int i = 0; i < connSize; i++) {
-        MYSQL* conn = nullptr;
-        conn = mysql_init(conn);
-        if(!conn) {
-            LOG_ERROR("MySql init error!");
-            assert(conn);
+        if(Open_(i)) {
+            closed_.erase(std::find(closed_.begin(), closed_.end(), i));
+            idle_.push_back(i);
+            open_++;
         }
-        conn = mysql_real_connect(conn, host, user, pwd, dbName, port, nullptr, 0);
-        if (!conn) {
-            LOG_ERROR("MySql Connect error!");
+    }
+}
+
+MYSQL* SqlConnPool::GetConn(int timeoutMS) {
+    Lease& lease = lease_;
+    if(lease.conn && !lease.inUse) {
+        if(lease.pool == this && lease.epoch == epoch_.load(std::memory_order_relaxed)) {
+            if(Check_(lease.idx)) {
+                lease.conn = slots_[lease.idx].sql.load(std::memory_order_relaxed);    // 可能重连过
+                lease.inUse = true;
+                return lease.conn;
+            }
+            Unlease_(lease);                // 重连失败，槽位还给池
+        } else {
+            lease.conn = nullptr;
+        }
+    }
+    MYSQL* conn = Acquire_(timeoutMS);
+    if(conn && lease.bound && !lease.conn) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(leased_ < minSize_ - 1) {
+            busy_--;
+            leased_++;
+            lease.pool = this;
+            lease.epoch = epoch_.load(std::memory_order_relaxed);
+            lease.idx = Index_(conn);
+            lease.conn = conn;
+            lease.inUse = true;
+            slots_[lease.idx].leased = true;
         }
-        connQue_.emplace(conn);
     }
-    MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    return conn;
 }
 
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL* conn = nullptr;
-    if(connQue_.empty()) {
-        LOG_WARN("SqlConnPool busy!");
+MYSQL* SqlConnPool::Acquire_(int timeoutMS) {
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::milliseconds(timeoutMS < 0 ? timeoutMS_ : timeoutMS);
+    std::unique_lock<std::mutex> locker(mtx_);
+    if(closing_ || !slots_) {
         return nullptr;
     }
-    sem_wait(&semId_);  // -1
-    lock_guard<mutex> locker(mtx_);
-    conn = connQue_.front();
-    connQue_.pop();
-    return conn;
+    int idx;
+    bool fresh = false;                     // 槽位上还没有连接，要新建
+    bool waited = false;
+    if(!idle_.empty() && waiters_.empty()) {
+        idx = idle_.back();
+        idle_.pop_back();
+    } else if(open_ < minSize_) {           // 连接断开后补足最小连接数
+        idx = closed_.back();
+        closed_.pop_back();
+        open_++;
+        fresh = true;
+    } else {
+        idx = Wait_(locker, start, deadline, &fresh);
+        waited = true;
+        if(idx < 0) {
+            LOG_WARN("SqlConnPool busy!");
+            return nullptr;
+        }
+    }
+    busy_++;
+    peakBusy_ = std::max(peakBusy_, busy_);
+    locker.unlock();
+    bool ok = fresh ? Open_(idx) : Check_(idx);
+    locker.lock();
+    if(!ok) {                               // 数据库连不上，不再重试，槽位留给之后的请求
+        busy_--;
+        open_--;
+        closed_.push_back(idx);
+        EndLibrary_();
+        return nullptr;
+    }
+    acquires_++;
+    if(waited) {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        waitUs_ += us;
+        maxWaitUs_ = std::max(maxWaitUs_, us);
+    }
+    return slots_[idx].sql.load(std::memory_order_relaxed);
+}
+
+// 排队等别人归还连接；排了GROW_WAIT_MS还没等到且没到上限时自己新建一个
+int SqlConnPool::Wait_(std::unique_lock<std::mutex>& locker, Clock::time_point start,
+                       Clock::time_point deadline, bool* fresh) {
+    Waiter waiter;
+    waiters_.push_back(&waiter);
+    waits_++;
+    Clock::time_point growAt = start + std::chrono::milliseconds(GROW_WAIT_MS);
+    while(waiter.idx < 0 && !closing_) {
+        Clock::time_point now = Clock::now();
+        if(now >= deadline) {
+            break;
+        }
+        if(open_ < maxSize_) {
+            if(now >= growAt) {
+                waiter.idx = closed_.back();
+                closed_.pop_back();
+                open_++;
+                grows_++;
+                *fresh = true;
+                break;
+            }
+            waiter.cond.wait_until(locker, std::min(growAt, deadline));
+        } else {
+            waiter.cond.wait_until(locker, deadline);
+        }
+    }
+    if(waiter.idx < 0 || *fresh) {          // 归还者交过来时已经把它移出队列
+        auto it = std::find(waiters_.begin(), waiters_.end(), &waiter);
+        if(it != waiters_.end()) {
+            waiters_.erase(it);
+        }
+    }
+    if(waiter.idx < 0 && !closing_) {
+        timeouts_++;
+    }
+    return waiter.idx;
 }
 
-// 存入连接池，实际上没有关闭
+// 空闲太久或上次出过错的连接先ping一下，不通就重连，重连后原来的预编译语句作废
+bool SqlConnPool::Check_(int idx) {
+    Slot& slot = slots_[idx];
+    if(!slot.suspect && Clock::now() - slot.lastUsed < std::chrono::milliseconds(PING_IDLE_MS)) {
+        return true;
+    }
+    slot.suspect = false;
+    MYSQL* sql = slot.sql.load(std::memory_order_relaxed);
+    if(mysql_ping(sql) == 0) {
+        slot.lastUsed = Clock::now();
+        return true;
+    }
+    LOG_WARN("MySql connection lost: %s, reconnect", mysql_error(sql));
+    reconnects_++;
+    Close_(idx);
+    return Open_(idx);
+}
+
+bool SqlConnPool::Open_(int idx) {
+    MYSQL* sql = mysql_init(nullptr);
+    if(!sql) {
+        LOG_ERROR("MySql init error!");
+        return false;
+    }
+    if(!mysql_real_connect(sql, host_.c_str(), user_.c_str(), pwd_.c_str(), dbName_.c_str(), port_, nullptr, 0)) {
+        LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+        mysql_close(sql);
+        return false;
+    }
+    Slot& slot = slots_[idx];
+    slot.lastUsed = Clock::now();
+    slot.suspect = false;
+    slot.sql.store(sql, std::memory_order_release);
+    return true;
+}
+
+void SqlConnPool::Close_(int idx) {
+    Slot& slot = slots_[idx];
+    MYSQL* sql = slot.sql.load(std::memory_order_relaxed);
+    if(!sql) {
+        return;
+    }
+    for(auto& item : slot.stmts) {
+        mysql_stmt_close(item.second);
+    }
+    slot.stmts.clear();
+    slot.sql.store(nullptr, std::memory_order_release);
+    mysql_close(sql);
+}
+
+// 槽位不多，直接顺序查找，不用加锁
+int SqlConnPool::Index_(MYSQL* conn) const {
+    for(int i = 0; i < maxSize_; i++) {
+        if(slots_[i].sql.load(std::memory_order_acquire) == conn) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 存入连接池，实际上没有关闭；租约上的连接留给本线程下次用
 void SqlConnPool::FreeConn(MYSQL* conn) {
     assert(conn);
-    lock_guard<mutex> locker(mtx_);
-    connQue_.push(conn);
-    sem_post(&semId_);  // +1
+    Lease& lease = lease_;
+    bool leased = (lease.inUse && conn == lease.conn);
+    int idx = leased ? lease.idx : Index_(conn);
+    assert(idx >= 0);
+    Slot& slot = slots_[idx];
+    unsigned int code = mysql_errno(conn);
+    slot.suspect = (code == 2006 || code == 2013);  // CR_SERVER_GONE_ERROR, CR_SERVER_LOST
+    slot.lastUsed = Clock::now();
+    if(leased) {
+        lease.inUse = false;
+        if(slot.suspect) {
+            Unlease_(lease);                // 出错的连接退回共享队列，取出时先检查
+        }
+        return;
+    }
+    Release_(idx, false);
+}
+
+void SqlConnPool::Unlease_(Lease& lease) {
+    int idx = lease.idx;
+    lease.conn = nullptr;
+    lease.idx = -1;
+    lease.inUse = false;
+    Release_(idx, true);
+}
+
+// 有人排队时直接交给队首
+void SqlConnPool::Release_(int idx, bool leased) {
+    Slot& slot = slots_[idx];
+    int cold = -1;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(leased) {
+            leased_--;
+            slot.leased = false;
+        } else {
+            busy_--;
+        }
+        if(!slot.sql.load(std::memory_order_relaxed)) {     // 重连失败的槽位
+            open_--;
+            closed_.push_back(idx);
+            EndLibrary_();
+        } else if(closing_) {
+            cold = idx;
+        } else if(!waiters_.empty()) {
+            Waiter* waiter = waiters_.front();
+            waiters_.pop_front();
+            waiter->idx = idx;
+            waiter->cond.notify_one();
+        } else {
+            idle_.push_back(idx);
+            // 超出最小连接数时，栈底空闲太久的连接关掉，一次只关一个
+            if(open_ > minSize_ && idle_.size() > 1 &&
+               slot.lastUsed - slots_[idle_.front()].lastUsed > std::chrono::milliseconds(IDLE_CLOSE_MS)) {
+                cold = idle_.front();
+                idle_.erase(idle_.begin());
+                shrinks_++;
+            }
+        }
+    }
+    if(cold >= 0) {
+        Close_(cold);
+        std::lock_guard<std::mutex> locker(mtx_);
+        open_--;
+        closed_.push_back(cold);
+        EndLibrary_();
+    }
 }
 
 void SqlConnPool::ClosePool() {
-    lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto conn = connQue_.front();
-        connQue_.pop();
-        mysql_close(conn);
+    std::lock_guard<std::mutex> locker(mtx_);
+    closing_ = true;
+    for(Waiter* waiter : waiters_) {
+        waiter->cond.notify_one();
+    }
+    waiters_.clear();
+    // 还在用的连接归还时再关
+    for(int idx : idle_) {
+        Close_(idx);
+        closed_.push_back(idx);
+        open_--;
+    }
+    idle_.clear();
+    EndLibrary_();
+}
+
+// 关闭中且连接全部关掉后结束mysql库，每次Init后只调用一次；调用时持有mtx_
+void SqlConnPool::EndLibrary_() {
+    if(closing_ && open_ == 0 && libraryUp_) {
+        libraryUp_ = false;
+        mysql_library_end();
     }
-    mysql_library_end();
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* conn, const char* sql) {
+    int idx = Index_(conn);
+    if(idx < 0) {
+        return nullptr;
+    }
+    auto& stmts = slots_[idx].stmts;
+    for(auto& item : stmts) {
+        if(item.first == sql || strcmp(item.first, sql) == 0) {
+            return item.second;
+        }
+    }
+    MYSQL_STMT* stmt = mysql_stmt_init(conn);
+    if(!stmt) {
+        LOG_ERROR("MySql stmt init error!");
+        return nullptr;
+    }
+    if(mysql_stmt_prepare(stmt, sql, strlen(sql))) {
+        LOG_ERROR("MySql prepare error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    stmts.emplace_back(sql, stmt);
+    return stmt;
 }
 
 int SqlConnPool::GetFreeConnCount() {
-    lock_guard<mutex> locker(mtx_);
-    return connQue_.size();
+    std::lock_guard<std::mutex> locker(mtx_);
+    return idle_.size();
+}
+
+SqlConnPool::Stats SqlConnPool::GetStats() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return {acquires_, waits_, timeouts_, waitUs_, maxWaitUs_, reconnects_.load(), grows_, shrinks_,
+            open_, busy_, peakBusy_, (int)waiters_.size(), leased_};
 }
@@ -3,9 +3,13 @@
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
 #include <thread>
 #include "../log/log.h"
 
@@ -13,24 +17,116 @@ class SqlConnPool {
 public:
     static SqlConnPool *Instance();
 
-    MYSQL *GetConn();
+    // 没有空闲连接时按到达顺序排队，归还的连接直接交给队首，后来的线程抢不走
+    // 排队超过GROW_WAIT_MS且连接数没到上限时新建一个；timeoutMS<0时用Init给的值，超时或连接失败返回nullptr
+    MYSQL *GetConn(int timeoutMS = -1);
     void FreeConn(MYSQL * conn);
     int GetFreeConnCount();
 
+    // 当前线程第一次取到连接后一直占用(租约)，之后取还都只访问线程局部变量，不加锁也没有原子操作
+    // 由线程池的工作线程启动时调用；最多minSize-1个线程能拿到租约，至少留一个连接在共享队列给其余线程
+    // 租约在线程退出时归还，连接出错时退回共享队列检查，下次再租
+    static void BindThread();
+
+    struct Stats {
+        uint64_t acquires;                  // 取到连接的次数
+        uint64_t waits;                     // 其中排过队的次数
+        uint64_t timeouts;
+        uint64_t waitUs;                    // 排队的总时间
+        uint64_t maxWaitUs;
+        uint64_t reconnects;
+        uint64_t grows;                     // 按需新建的连接数
+        uint64_t shrinks;                   // 空闲太久关掉的连接数
+        int open;                           // 当前建立的连接数
+        int busy;                           // 当前取出在用的连接数
+        int peakBusy;
+        int waiting;                        // 当前排队的线程数
+        int leased;                         // 被线程长期占用的连接数，不计入busy
+    };
+    Stats GetStats();
+
+    // 连接上缓存的预编译语句，sql为字符串常量，第一次用到时prepare，出错返回nullptr
+    // 只有持有该连接的线程会用到它的缓存，不加锁；连接重连后缓存清空
+    MYSQL_STMT* GetStmt(MYSQL* conn, const char* sql);
+
+    // 启动时建立connSize个连接并一直保持；maxSize大于connSize时按需扩容，多出的连接空闲IDLE_CLOSE_MS后关闭
+    // 重新Init前取出的连接要全部归还，持有租约的线程要已经退出
     void Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* user,const char* pwd,
+              const char* dbName, int connSize, int maxSize = 0, int timeoutMS = 1000);
+    // 空闲连接立即关闭，在用的连接归还时再关；最后一个连接关闭后才结束mysql库
     void ClosePool();
 
 private:
+    typedef std::chrono::steady_clock Clock;
+
     SqlConnPool() = default;
     ~SqlConnPool() { ClosePool(); }
 
-    int MAX_CONN_;
+    // 每个连接一个槽位，数量为maxSize，Init后不再变化；sql为空表示槽位上没有连接
+    struct Slot {
+        std::atomic<MYSQL*> sql{nullptr};
+        std::vector<std::pair<const char*, MYSQL_STMT*>> stmts;
+        Clock::time_point lastUsed;
+        bool suspect = false;               // 上次使用时连接断了，下次取出前先检查
+        bool leased = false;
+    };
+
+    // 线程的租约，epoch与池不同说明池已重新Init，租约作废
+    struct Lease {
+        bool bound = false;                 // 调用过BindThread
+        SqlConnPool* pool = nullptr;
+        uint64_t epoch = 0;
+        int idx = -1;
+        MYSQL* conn = nullptr;
+        bool inUse = false;
+        ~Lease();
+    };
+
+    struct Waiter {
+        std::condition_variable cond;
+        int idx = -1;                       // 交给它的槽位
+    };
 
-    std::queue<MYSQL *> connQue_;
+    int Wait_(std::unique_lock<std::mutex>& locker, Clock::time_point start,
+              Clock::time_point deadline, bool* fresh);
+    bool Check_(int idx);
+    bool Open_(int idx);
+    void Close_(int idx);
+    int Index_(MYSQL* conn) const;
+    MYSQL* Acquire_(int timeoutMS);
+    void Release_(int idx, bool leased);
+    void Unlease_(Lease& lease);
+    void EndLibrary_();
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_ = 0;
+    int minSize_ = 0;
+    int maxSize_ = 0;
+    int timeoutMS_ = 0;
+    bool closing_ = false;
+    bool libraryUp_ = false;                // Init过且还没调用mysql_library_end
+
+    std::unique_ptr<Slot[]> slots_;
+    std::vector<int> idle_;                 // 后进先出，最久没用的沉在底部，缩容时先关它
+    std::vector<int> closed_;               // 没有连接的槽位
+    std::deque<Waiter*> waiters_;
+    int open_ = 0;                          // 含正在建立的连接
+    int busy_ = 0;
+    int peakBusy_ = 0;
+    int leased_ = 0;
+    std::atomic<uint64_t> epoch_{0};        // 每次Init加一
+
+    static thread_local Lease lease_;
+
+    uint64_t acquires_ = 0, waits_ = 0, timeouts_ = 0, waitUs_ = 0, maxWaitUs_ = 0;
+    uint64_t grows_ = 0, shrinks_ = 0;
+    std::atomic<uint64_t> reconnects_{0};
     std::mutex mtx_;
-    sem_t semId_;
+
+    static constexpr int GROW_WAIT_MS = 10;
+    static constexpr int PING_IDLE_MS = 30000;  // 空闲超过这个时间的连接取出前ping一下
+    static constexpr int IDLE_CLOSE_MS = 60000;
 };
 
 /* 资源在对象构造初始化 资源在对象析构时释放*/
@@ -9,6 +9,7 @@
 #include <thread>
 #include <assert.h>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
@@ -18,30 +19,33 @@ public:
     ThreadPool() = default;
     ThreadPool(ThreadPool&&) = default;
     // 尽量用make_shared代替new，如果通过new再传递给shared_ptr，内存是不连续的的，会造成内存碎片化
-    explicit ThreadPool(int threadCount = 8) : pool_(make_shared<Pool>()) // make_shared:传递右值，功能是在动态内存中分配一个对象并初始化它。返回指向此对象的shared_ptr
+    // onStart在每个工作线程开始取任务前调用，参数为线程序号，可用于绑核
+    explicit ThreadPool(int threadCount = 8, function<void(int)> onStart = nullptr) : pool_(make_shared<Pool>()) // make_shared:传递右值，功能是在动态内存中分配一个对象并初始化它。返回指向此对象的shared_ptr
     {
         assert(threadCount > 0);                                          // 判断线程数是否大于零
         for(int i = 0;i < threadCount; ++i)                               // 根据线程数添加线程任务
         {
-            thread([this]()                                               
+            workers_.emplace_back([pool = pool_, onStart, i]()            // 持有pool的拷贝，不依赖this
             {
-                unique_lock<mutex> locker(pool_->mtx_);                   // 用lambda表达式添加线程任务，上锁
+                if(onStart)
+                    onStart(i);
+                unique_lock<mutex> locker(pool->mtx_);                    // 用lambda表达式添加线程任务，上锁
                 while(true)
                 {
-                    if (!pool_->tasks.empty())                            // 当任务队列不为空时
+                    if (!pool->tasks.empty())                             // 当任务队列不为空时
                     {
-                        auto task = move(pool_->tasks.front());           // 取任务，左值边右值，资产转移
-                        pool_->tasks.pop();                               // 弹出队列
+                        auto task = move(pool->tasks.front());            // 取任务，左值边右值，资产转移
+                        pool->tasks.pop();                                // 弹出队列
                         locker.unlock();                                  // 因为已经把任务取出来了，所以可以解锁
                         task();                                           // 执行任务
                         locker.lock();                                    // 马上又要取任务了，上锁
                     }
-                    else if (pool_->isClosed)
+                    else if (pool->isClosed)
                         break;
                     else
-                        pool_->cond_.wait(locker);                        // 等待，如果任务来了就notify
+                        pool->cond_.wait(locker);                         // 等待，如果任务来了就notify
                 }
-            }).detach();
+            });
         }    
     }
 
@@ -49,10 +53,14 @@ public:
     {
         if (pool_)
         {
-            unique_lock<mutex> locker(pool_->mtx_);
-            pool_->isClosed = true;
+            {
+                unique_lock<mutex> locker(pool_->mtx_);
+                pool_->isClosed = true;
+            }
+            pool_->cond_.notify_all();                                    // 唤醒所有线程
         }
-        pool_->cond_.notify_all();                                        // 唤醒所有线程
+        for(auto& worker : workers_)                                      // 等待剩余任务执行完，线程退出
+            worker.join();
     }
 
     template<typename T>
@@ -63,6 +71,12 @@ public:
         pool_->cond_.notify_one();
     }
 
+    size_t TaskCount()                                                    // 排队中尚未执行的任务数，用作负载信号
+    {
+        lock_guard<mutex> locker(pool_->mtx_);
+        return pool_->tasks.size();
+    }
+
 private:
     // 使用一个结构体封装起来，方便调用
     struct Pool
@@ -73,6 +87,7 @@ private:
         queue<function<void()>> tasks; // 任务队列，函数类型为void()
     };
     shared_ptr<Pool> pool_;
+    vector<thread> workers_;
 };
 
 
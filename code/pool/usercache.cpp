@@ -0,0 +1,111 @@
+#include "usercache.h"
+#include "siphash.h"
+#include <random>
+#include <string.h>
+
+UserCache* UserCache::Instance() {
+    static UserCache cache;
+    return &cache;
+}
+
+UserCache::UserCache() : capacity_(0), shardCapacity_(0), ttl_(0), key_{0, 0}, hits_(0), misses_(0) {
+}
+
+void UserCache::Init(size_t capacity, int ttlMs) {
+    Clear();
+    capacity_ = capacity;
+    shardCapacity_ = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+    ttl_ = std::chrono::milliseconds(ttlMs);
+    std::random_device rd;
+    key_[0] = (static_cast<uint64_t>(rd()) << 32) | rd();
+    key_[1] = (static_cast<uint64_t>(rd()) << 32) | rd();
+    hits_ = misses_ = 0;
+}
+
+UserCache::Shard& UserCache::ShardOf_(std::string_view name) {
+    return shards_[std::hash<std::string_view>()(name) % SHARD_NUM];
+}
+
+UserCache::RESULT UserCache::Find(std::string_view name, std::string_view pwd) {
+    if(!Enabled()) {
+        return ABSENT;
+    }
+    uint64_t verifier = Verifier_(name, pwd);
+    Shard& shard = ShardOf_(name);
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto it = shard.index.find(name);
+        if(it != shard.index.end()) {
+            auto node = it->second;
+            if(node->expire > Clock::now()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, node);
+                hits_++;
+                return node->verifier == verifier ? MATCH : MISMATCH;
+            }
+            shard.index.erase(it);
+            shard.lru.erase(node);
+        }
+    }
+    misses_++;
+    return ABSENT;
+}
+
+// 写穿：库里的密码已确认(或刚插入)后调用，已有的条目更新校验值并续期
+void UserCache::Put(std::string_view name, std::string_view pwd) {
+    if(!Enabled()) {
+        return;
+    }
+    uint64_t verifier = Verifier_(name, pwd);
+    Shard& shard = ShardOf_(name);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        auto node = it->second;
+        node->verifier = verifier;
+        node->expire = Clock::now() + ttl_;
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);
+        return;
+    }
+    if(shard.lru.size() >= shardCapacity_) {
+        shard.index.erase(shard.lru.back().name);
+        shard.lru.pop_back();
+    }
+    shard.lru.push_front({std::string(name), verifier, Clock::now() + ttl_});
+    shard.index.emplace(shard.lru.front().name, shard.lru.begin());
+}
+
+void UserCache::Erase(std::string_view name) {
+    Shard& shard = ShardOf_(name);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+void UserCache::Clear() {
+    for(auto& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        shard.index.clear();
+        shard.lru.clear();
+    }
+}
+
+size_t UserCache::Size() {
+    size_t size = 0;
+    for(auto& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        size += shard.lru.size();
+    }
+    return size;
+}
+
+// 输入为 name + '\0' + pwd
+uint64_t UserCache::Verifier_(std::string_view name, std::string_view pwd) const {
+    SipHash hash(key_[0], key_[1]);
+    hash.Update(name.data(), name.size());
+    hash.Update("", 1);
+    hash.Update(pwd.data(), pwd.size());
+    return hash.Final();
+}
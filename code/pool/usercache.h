@@ -0,0 +1,74 @@
+#ifndef USERCACHE_H
+#define USERCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// 用户名 -> 密码校验值的进程内缓存，挡在user表前面，重复登录不必查库
+// 只缓存数据库确认过的用户名和密码(登录成功、注册成功时写入)，存的是带随机密钥的SipHash而不是密码本身
+// 按用户名哈希分片，每片一把锁、一条LRU链表，条目超过ttl后视为不存在
+class UserCache {
+public:
+    enum RESULT {
+        ABSENT,         // 没有缓存(或已过期)，需要查库
+        MATCH,          // 用户存在且密码一致
+        MISMATCH,       // 用户存在但密码不一致，库里的密码可能已经改过，登录仍需查库
+    };
+
+    static UserCache* Instance();
+
+    // capacity为0时关闭缓存，Find始终返回ABSENT
+    void Init(size_t capacity, int ttlMs = DEFAULT_TTL_MS);
+    bool Enabled() const { return capacity_ > 0; }
+
+    RESULT Find(std::string_view name, std::string_view pwd);
+    void Put(std::string_view name, std::string_view pwd);
+    void Erase(std::string_view name);
+    void Clear();
+
+    // Find的命中(MATCH/MISMATCH)与未命中次数
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+    size_t Size();
+
+    static const int DEFAULT_TTL_MS = 5 * 60 * 1000;
+
+private:
+    UserCache();
+    ~UserCache() = default;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string name;
+        uint64_t verifier;
+        Clock::time_point expire;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;                   // 表头最近使用
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;     // 键指向链表节点里的name
+    };
+
+    Shard& ShardOf_(std::string_view name);
+    uint64_t Verifier_(std::string_view name, std::string_view pwd) const;
+
+    static const int SHARD_NUM = 16;
+
+    Shard shards_[SHARD_NUM];
+    size_t capacity_;
+    size_t shardCapacity_;
+    Clock::duration ttl_;
+    uint64_t key_[2];                           // SipHash密钥，Init时随机生成
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+};
+
+#endif // USERCACHE_H
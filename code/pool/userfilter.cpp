@@ -0,0 +1,83 @@
+#include "userfilter.h"
+#include <string>
+#include <vector>
+
+UserFilter* UserFilter::Instance() {
+    static UserFilter filter;
+    return &filter;
+}
+
+void UserFilter::Init(size_t expected) {
+    skips_ = 0;
+    if(expected == 0) {
+        bits_.reset();
+        mask_ = 0;
+        return;
+    }
+    size_t bits = 64;
+    while(bits < expected * BITS_PER_KEY) {
+        bits <<= 1;
+    }
+    bits_.reset(new std::atomic<uint64_t>[bits / 64]);
+    for(size_t i = 0; i < bits / 64; i++) {
+        bits_[i].store(0, std::memory_order_relaxed);
+    }
+    mask_ = bits - 1;
+}
+
+bool UserFilter::Load(UserStore* store) {
+    std::vector<std::string> names;
+    if(!store->ForEach([&names](std::string_view name) { names.emplace_back(name); })) {
+        LOG_ERROR("Load user filter error!");
+        Init(0);
+        return false;
+    }
+    Init(names.size() * 2 > MIN_KEYS ? names.size() * 2 : MIN_KEYS);
+    for(auto& name : names) {
+        Add(name);
+    }
+    LOG_INFO("User filter: %zu users, %zu bits", names.size(), mask_ + 1);
+    return true;
+}
+
+// 双重哈希：由一个64位哈希的高低两半生成HASH_NUM个位置
+static inline uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// 其他用户名并发置位只会让结果从不存在变为可能存在，只需与同一用户名的加入互斥
+bool UserFilter::Add(std::string_view name) {
+    if(!Enabled()) {
+        return false;
+    }
+    uint64_t h = Mix(std::hash<std::string_view>()(name));
+    uint32_t h1 = static_cast<uint32_t>(h), h2 = static_cast<uint32_t>(h >> 32) | 1;
+    bool added = false;
+    std::lock_guard<std::mutex> locker(locks_[h % LOCK_NUM]);
+    for(int i = 0; i < HASH_NUM; i++) {
+        size_t bit = (h1 + static_cast<size_t>(i) * h2) & mask_;
+        uint64_t mask = 1ULL << (bit % 64);
+        if(!(bits_[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask)) {
+            added = true;
+        }
+    }
+    return added;
+}
+
+bool UserFilter::MayContain(std::string_view name) const {
+    if(!Enabled()) {
+        return true;
+    }
+    uint64_t h = Mix(std::hash<std::string_view>()(name));
+    uint32_t h1 = static_cast<uint32_t>(h), h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for(int i = 0; i < HASH_NUM; i++) {
+        size_t bit = (h1 + static_cast<size_t>(i) * h2) & mask_;
+        if(!(bits_[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
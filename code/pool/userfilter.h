@@ -0,0 +1,47 @@
+#ifndef USERFILTER_H
+#define USERFILTER_H
+
+#include <stdint.h>
+#include <string_view>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "userstore.h"
+
+// user表中用户名的布隆过滤器，启动时从表里建好，之后注册时加入
+// MayContain()返回false说明用户名一定不存在：登录直接失败，注册不必先查询，用户名试探类的请求不再打到数据库
+// 前提是本进程是user表唯一的写入者，其他途径插入的用户在重建之前会被误判为不存在
+// 位数组按64位原子字操作，查询不加锁；加入按哈希分段加锁，同一用户名的检查和置位是原子的
+class UserFilter {
+public:
+    static UserFilter* Instance();
+
+    // 按预计的用户数分配，每个用户BITS_PER_KEY位，误判率约1%；expected为0时关闭，MayContain始终返回true
+    void Init(size_t expected);
+    // 读出store中全部用户名建立过滤器，按现有用户数的两倍预留
+    bool Load(UserStore* store);
+    bool Enabled() const { return bits_ != nullptr; }
+
+    // 加入用户名，返回加入前是否一定不存在；并发加入同一用户名时只有一个返回true，关闭时返回false
+    bool Add(std::string_view name);
+    bool MayContain(std::string_view name) const;
+
+    void CountSkip() { skips_++; }             // 因为一定不存在而省掉的查询
+    uint64_t Skips() const { return skips_; }
+
+    static const size_t BITS_PER_KEY = 10;
+    static const int HASH_NUM = 7;
+    static const size_t MIN_KEYS = 1 << 16;
+    static const int LOCK_NUM = 64;
+
+private:
+    UserFilter() : mask_(0), skips_(0) {}
+    ~UserFilter() = default;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+    size_t mask_;                               // 位数减1，位数为2的幂
+    std::mutex locks_[LOCK_NUM];                // 只串行化同一段内的加入，不同用户名置位互不影响正确性
+    std::atomic<uint64_t> skips_;
+};
+
+#endif // USERFILTER_H
@@ -0,0 +1,129 @@
+#include "userstore.h"
+#include <string.h>
+
+std::atomic<UserStore*> UserStore::current_(nullptr);
+
+UserStore* UserStore::Instance() {
+    UserStore* store = current_.load(std::memory_order_acquire);
+    if(store) {
+        return store;
+    }
+    static MySqlUserStore mysql(SqlConnPool::Instance());
+    return &mysql;
+}
+
+void UserStore::Use(UserStore* store) {
+    current_.store(store, std::memory_order_release);
+}
+
+// 参数和结果都走二进制协议，不拼接语句文本
+static const char SELECT_USER_SQL[] = "SELECT password FROM user WHERE username=? LIMIT 1";
+static const char INSERT_USER_SQL[] = "INSERT INTO user(username, password) VALUES(?, ?)";
+
+static void BindString(MYSQL_BIND* bind, const char* data, unsigned long size, unsigned long* len) {
+    *len = size;
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = const_cast<char*>(data);
+    bind->buffer_length = size;
+    bind->length = len;
+}
+
+static bool ExecuteStmt(MYSQL_STMT* stmt, MYSQL_BIND* params) {
+    if(!stmt) {
+        return false;
+    }
+    if(mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt)) {
+        LOG_ERROR("MySql stmt error %u: %s", mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+        return false;
+    }
+    return true;
+}
+
+// 密码比缓冲区长时按实际长度再取一次
+UserStore::RESULT MySqlUserStore::Select_(MYSQL* sql, std::string_view name, std::string* pwd) {
+    MYSQL_STMT* stmt = pool_->GetStmt(sql, SELECT_USER_SQL);
+    MYSQL_BIND param;
+    unsigned long nameLen;
+    memset(&param, 0, sizeof(param));
+    BindString(&param, name.data(), name.size(), &nameLen);
+    if(!ExecuteStmt(stmt, &param)) {
+        return FAILED;
+    }
+    char stored[256];
+    unsigned long len = 0;
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = stored;
+    result.buffer_length = sizeof(stored);
+    result.length = &len;
+    int ret = mysql_stmt_bind_result(stmt, &result) ? 1 : mysql_stmt_fetch(stmt);
+    RESULT res = FAILED;
+    if(ret == 0) {
+        pwd->assign(stored, len);
+        res = OK;
+    } else if(ret == MYSQL_DATA_TRUNCATED) {
+        pwd->resize(len);
+        result.buffer = &(*pwd)[0];
+        result.buffer_length = len;
+        res = mysql_stmt_fetch_column(stmt, &result, 0, 0) ? FAILED : OK;
+    } else if(ret == MYSQL_NO_DATA) {
+        res = NOT_FOUND;
+    }
+    mysql_stmt_free_result(stmt);
+    return res;
+}
+
+UserStore::RESULT MySqlUserStore::Find(std::string_view name, std::string* pwd) {
+    MYSQL* sql;
+    SqlConnRAII conn(&sql, pool_);
+    if(!sql) {
+        return FAILED;                      // 排队超时或数据库连不上
+    }
+    return Select_(sql, name, pwd);
+}
+
+// 查询和插入用同一个连接
+UserStore::RESULT MySqlUserStore::Insert(std::string_view name, std::string_view pwd, bool absent) {
+    MYSQL* sql;
+    SqlConnRAII conn(&sql, pool_);
+    if(!sql) {
+        return FAILED;
+    }
+    if(!absent) {
+        std::string stored;
+        RESULT res = Select_(sql, name, &stored);
+        if(res != NOT_FOUND) {
+            return res == OK ? EXISTS : res;
+        }
+    }
+    MYSQL_BIND params[2];
+    unsigned long lens[2];
+    memset(params, 0, sizeof(params));
+    BindString(&params[0], name.data(), name.size(), &lens[0]);
+    BindString(&params[1], pwd.data(), pwd.size(), &lens[1]);
+    if(!ExecuteStmt(pool_->GetStmt(sql, INSERT_USER_SQL), params)) {
+        LOG_DEBUG("Insert error!");
+        return FAILED;
+    }
+    return OK;
+}
+
+bool MySqlUserStore::ForEach(const std::function<void(std::string_view name)>& fn) {
+    MYSQL* sql;
+    SqlConnRAII conn(&sql, pool_);
+    if(!sql || mysql_query(sql, "SELECT username FROM user")) {
+        return false;
+    }
+    MYSQL_RES* res = mysql_store_result(sql);
+    if(!res) {
+        return false;
+    }
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        if(row[0]) {
+            fn(row[0]);
+        }
+    }
+    mysql_free_result(res);
+    return true;
+}
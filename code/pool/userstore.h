@@ -0,0 +1,58 @@
+#ifndef USERSTORE_H
+#define USERSTORE_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <atomic>
+#include "sqlconnpool.h"
+
+// user表的存储引擎：按用户名查密码、新增用户、遍历用户名(供UserFilter建表)
+// UserVerity只通过这里访问用户数据，实现需要能被多个工作线程同时调用
+class UserStore {
+public:
+    enum RESULT {
+        OK,             // Find找到了用户，Insert插入成功
+        NOT_FOUND,
+        EXISTS,         // Insert时用户名已被使用
+        FAILED,         // 出错，如数据库连不上
+    };
+
+    virtual ~UserStore() = default;
+
+    virtual const char* Name() const = 0;
+    // 找到时把密码写入*pwd
+    virtual RESULT Find(std::string_view name, std::string* pwd) = 0;
+    // absent为true表示调用者已确定用户名不存在(过滤器)，引擎可以省掉检查
+    virtual RESULT Insert(std::string_view name, std::string_view pwd, bool absent) = 0;
+    // 依次回调所有用户名，出错返回false
+    virtual bool ForEach(const std::function<void(std::string_view name)>& fn) = 0;
+    // 查找要经过网络，并发的相同查找值得合并
+    virtual bool Remote() const = 0;
+
+    // 当前使用的引擎，默认为MySqlUserStore；Use在服务启动前调用，不转移所有权，nullptr恢复默认
+    static UserStore* Instance();
+    static void Use(UserStore* store);
+
+private:
+    static std::atomic<UserStore*> current_;
+};
+
+// 经SqlConnPool访问MySQL的user表，两条语句在每个连接上只prepare一次
+class MySqlUserStore : public UserStore {
+public:
+    explicit MySqlUserStore(SqlConnPool* pool) : pool_(pool) {}
+
+    const char* Name() const override { return "mysql"; }
+    RESULT Find(std::string_view name, std::string* pwd) override;
+    RESULT Insert(std::string_view name, std::string_view pwd, bool absent) override;
+    bool ForEach(const std::function<void(std::string_view name)>& fn) override;
+    bool Remote() const override { return true; }
+
+private:
+    RESULT Select_(MYSQL* sql, std::string_view name, std::string* pwd);
+
+    SqlConnPool* pool_;
+};
+
+#endif // USERSTORE_H
@@ -0,0 +1,66 @@
+#include "connslab.h"
+
+using namespace std;
+
+ConnSlab::ConnSlab(int maxFd): maxFd_(maxFd), mapSize_(sizeof(Slot) * maxFd), bound_(false),
+    pool_(pmr::pool_options{0, POOL_MAX_BLOCK}, &nodeMem_)
+{
+    assert(maxFd_ > 0);
+    // 匿名映射的页初始全0，即gen=0、constructed=false
+    void* addr = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(addr != MAP_FAILED);
+    slots_ = static_cast<Slot*>(addr);
+}
+
+ConnSlab::~ConnSlab()
+{
+    for(int fd = 0; fd < maxFd_; fd++)
+    {
+        if(slots_[fd].constructed)
+            slots_[fd].Conn()->~HttpConn();
+    }
+    munmap(slots_, mapSize_);
+}
+
+ConnSlab::Slot* ConnSlab::Acquire(int fd)
+{
+    assert(fd >= 0 && fd < maxFd_);
+    Slot* slot = &slots_[fd];
+    if(!slot->constructed)
+    {
+        new (slot->storage) HttpConn(bound_ ? &pool_ : nullptr);
+        slot->constructed = true;
+    }
+    slot->gen = (slot->gen + 1) & GEN_MASK;
+    slot->writing = false;
+    slot->recvArmed = false;
+    slot->recvPaused = false;
+    slot->closing = false;
+    slot->working = false;
+    return slot;
+}
+
+ConnSlab::Slot* ConnSlab::Get(int fd, uint32_t gen)
+{
+    if(fd < 0 || fd >= maxFd_)
+        return nullptr;
+    Slot* slot = &slots_[fd];
+    if(!slot->constructed || slot->gen != gen)
+        return nullptr;
+    return slot;
+}
+
+ConnSlab::Slot* ConnSlab::At(int fd)
+{
+    assert(fd >= 0 && fd < maxFd_ && slots_[fd].constructed);
+    return &slots_[fd];
+}
+
+bool ConnSlab::BindNode(int node)
+{
+    if(!Affinity::BindMemory(slots_, mapSize_, node))
+        return false;
+    nodeMem_.SetNode(node);
+    bound_ = true;
+    return true;
+}
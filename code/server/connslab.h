@@ -0,0 +1,60 @@
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <sys/mman.h>
+#include <new>
+#include <assert.h>
+#include <stdint.h>
+
+#include "../http/httpconn.h"
+#include "../buffer/noderesource.h"
+
+// 按fd下标的连接槽，替代unordered_map<int, HttpConn>
+// 一次性保留maxFd个槽的地址空间，物理页在fd第一次被使用时才分配，HttpConn也在那时构造
+// 每个reactor一个，只在该reactor上出现过的fd才占用物理页；BindNode后槽本身以及之后构造的连接的
+// 读写缓冲、请求arena都从该节点分配
+// 槽的地址不会变化，gen区分同一个fd先后承载的不同连接
+class ConnSlab
+{
+public:
+    struct alignas(64) Slot                             // 独占cache line，相邻fd不会伪共享
+    {
+        uint32_t gen;                                   // 连接代数，fd每承载一个新连接加一
+        bool writing;                                   // io_uring: 有writev在途
+        bool recvArmed;                                 // io_uring: multishot recv在途(含已取消但还没收到最后一个完成事件)
+        bool recvPaused;                                // io_uring: 读缓冲超过READ_WINDOW，暂停接收
+        bool closing;                                   // io_uring: 已shutdown，等在途的recv/writev都完成后再关闭fd
+        bool working;                                   // io_uring: 阻塞的处理函数在工作线程执行中，也要等它完成才能关闭
+        bool constructed;
+        alignas(HttpConn) unsigned char storage[sizeof(HttpConn)];
+
+        HttpConn* Conn() { return reinterpret_cast<HttpConn*>(storage); }
+    };
+
+    static const uint32_t GEN_MASK = 0xffffff;          // io_uring的user_data中只留了24位
+
+    explicit ConnSlab(int maxFd);
+    ~ConnSlab();
+
+    Slot* Acquire(int fd);                              // 新连接占用fd对应的槽
+    Slot* Get(int fd, uint32_t gen);                    // gen不符(旧连接残留的事件)返回nullptr
+    Slot* At(int fd);
+    int MaxFd() const { return maxFd_; }
+
+    // 把槽和连接的内存绑到node上，需在第一个连接之前调用；单节点时不做任何事，返回false
+    bool BindNode(int node);
+    bool Bound() const { return bound_; }
+
+private:
+    static const size_t POOL_MAX_BLOCK = 64 * 1024;     // 更大的缓冲区直接按页映射
+
+    int maxFd_;
+    size_t mapSize_;
+    Slot* slots_;
+
+    bool bound_;
+    NodeResource nodeMem_;                              // 按页从节点上映射
+    pmr::synchronized_pool_resource pool_;              // 切成小块给连接用，线程池模式下工作线程也会扩容缓冲区
+};
+
+#endif
@@ -12,20 +12,20 @@ Epoller::~Epoller()
     close(epollFd_);
 }
 
-bool Epoller::AddFd(int fd, uint32_t events)
+bool Epoller::AddFd(int fd, uint32_t events, uint32_t tag)
 {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (static_cast<uint64_t>(tag) << 32) | static_cast<uint32_t>(fd);
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
-bool Epoller::ModFd(int fd, uint32_t events)
+bool Epoller::ModFd(int fd, uint32_t events, uint32_t tag)
 {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (static_cast<uint64_t>(tag) << 32) | static_cast<uint32_t>(fd);
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
@@ -46,7 +46,14 @@ int Epoller::Wait(int timeoutMs)
 int Epoller::GetEventFd(size_t i) const
 {
     assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return static_cast<int>(events_[i].data.u64 & 0xffffffff);
+}
+
+// 获取事件的tag
+uint32_t Epoller::GetEventTag(size_t i) const
+{
+    assert(i < events_.size() && i >= 0);
+    return static_cast<uint32_t>(events_[i].data.u64 >> 32);
 }
 
 // 获取事件属性
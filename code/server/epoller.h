@@ -15,11 +15,13 @@ public:
     explicit Epoller(int maxEvent = 1024);
     ~Epoller();
 
-    bool AddFd(int fd, uint32_t events);
-    bool ModFd(int fd, uint32_t events); 
+    // tag与fd一起存进epoll_event.data，事件返回时原样带回
+    bool AddFd(int fd, uint32_t events, uint32_t tag = 0);
+    bool ModFd(int fd, uint32_t events, uint32_t tag = 0); 
     bool DelFd(int fd);
     int Wait(int timeoutMs = -1);
     int GetEventFd(size_t i) const;
+    uint32_t GetEventTag(size_t i) const;
     uint32_t GetEvents(size_t i) const;
     
 private:
@@ -0,0 +1,268 @@
+#include "iouring.h"
+
+using namespace std;
+
+IoUring::IoUring(unsigned entries, unsigned bufCount, unsigned bufSize):
+    entries_(entries), ringFd_(-1),
+    sqRing_(nullptr), sqRingSize_(0), sqes_(nullptr), sqeTail_(0), sqeHead_(0),
+    cqRing_(nullptr), cqRingSize_(0),
+    bufRing_(nullptr), bufRingSize_(0), bufCount_(bufCount), bufSize_(bufSize)
+{
+    assert(entries_ > 0);
+    assert(bufCount_ > 0 && (bufCount_ & (bufCount_ - 1)) == 0 && bufCount_ <= 32768);   // 缓冲区环大小必须是2的幂
+}
+
+IoUring::~IoUring()
+{
+    if(cqRing_ && cqRing_ != sqRing_)
+        munmap(cqRing_, cqRingSize_);
+    if(sqRing_)
+        munmap(sqRing_, sqRingSize_);
+    if(sqes_)
+        munmap(sqes_, entries_ * sizeof(struct io_uring_sqe));
+    if(ringFd_ >= 0)
+        close(ringFd_);
+    if(bufRing_)
+        munmap(bufRing_, bufRingSize_);
+}
+
+bool IoUring::Init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries_ * 4;               // multishot会产生大量CQE，CQ开大一些
+    ringFd_ = syscall(__NR_io_uring_setup, entries_, &params);
+    if(ringFd_ < 0)
+        return false;
+    entries_ = params.sq_entries;
+
+    // 需要单次mmap、带超时的等待以及CQ溢出不丢事件
+    const unsigned features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    if((params.features & features) != features)
+        return false;
+
+    // multishot recv(6.0)与SEND_ZC同时引入，以此判断内核版本
+    vector<char> probeMem(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(probeMem.data());
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PROBE, probe, 256) < 0
+        || probe->last_op < IORING_OP_SEND_ZC
+        || !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+        return false;
+
+    // SQ和CQ共用一次映射
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqRingSize_ = cqRingSize_ = max(sqRingSize_, cqRingSize_);
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED)
+    {
+        sqRing_ = nullptr;
+        return false;
+    }
+    cqRing_ = sqRing_;
+
+    sqes_ = static_cast<struct io_uring_sqe*>(mmap(nullptr, entries_ * sizeof(struct io_uring_sqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+    if(sqes_ == MAP_FAILED)
+    {
+        sqes_ = nullptr;
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqeHead_ = sqeTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    events_.reserve(params.cq_entries);
+    return SetupBufRing_();
+}
+
+// 注册提供给内核的接收缓冲区环，recv时由内核挑选缓冲区，不必为每个连接预留读缓冲
+bool IoUring::SetupBufRing_()
+{
+    bufRingSize_ = bufCount_ * sizeof(struct io_uring_buf);
+    void* ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(ring == MAP_FAILED)
+        return false;
+    bufRing_ = static_cast<struct io_uring_buf_ring*>(ring);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = bufCount_;
+    reg.bgid = BUF_GROUP;
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+
+    bufPool_.resize(static_cast<size_t>(bufCount_) * bufSize_);
+    for(unsigned i = 0; i < bufCount_; i++)
+        RecycleBuffer(i);
+    return true;
+}
+
+char* IoUring::GetBuffer(uint16_t bid)
+{
+    assert(bid < bufCount_);
+    return &bufPool_[static_cast<size_t>(bid) * bufSize_];
+}
+
+void IoUring::RecycleBuffer(uint16_t bid)
+{
+    // tail只有本线程写，内核只读
+    // 头文件里bufs是柔性数组，C++下偏移量不为0，这里直接按io_uring_buf数组访问
+    unsigned short tail = bufRing_->tail;
+    struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(bufRing_);
+    struct io_uring_buf* buf = &bufs[tail & (bufCount_ - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(GetBuffer(bid));
+    buf->len = bufSize_;
+    buf->bid = bid;
+    __atomic_store_n(&bufRing_->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+}
+
+void IoUring::BindNode(int node)
+{
+    if(!bufPool_.empty())
+        Affinity::BindMemory(bufPool_.data(), bufPool_.size(), node);
+}
+
+int IoUring::Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg)
+{
+    size_t argSize = (flags & IORING_ENTER_EXT_ARG) ? sizeof(struct io_uring_getevents_arg) : 0;
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, arg, argSize);
+}
+
+struct io_uring_sqe* IoUring::GetSqe_()
+{
+    // SQ满了先把已有的提交掉
+    if(sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= entries_)
+    {
+        __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+        Enter_(sqeTail_ - sqeHead_, 0, 0, nullptr);
+        sqeHead_ = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    }
+    unsigned index = sqeTail_ & *sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    sqeTail_++;
+    return sqe;
+}
+
+void IoUring::PrepAcceptMultishot(int fd, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = data;
+}
+
+void IoUring::PrepRecvMultishot(int fd, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = data;
+}
+
+void IoUring::PrepRead(int fd, void* buf, unsigned len, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->user_data = data;
+}
+
+// 单次poll，就绪一次产生一个完成事件，需要继续监听时重新提交
+void IoUring::PrepPollAdd(int fd, uint32_t events, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = data;
+}
+
+void IoUring::PrepWritev(int fd, const struct iovec* iov, int iovCnt, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = iovCnt;
+    sqe->user_data = data;
+}
+
+void IoUring::PrepCancel(uint64_t target, uint64_t data)
+{
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = data;
+}
+
+// 一次io_uring_enter提交本轮积累的所有SQE并等待至少一个完成事件，返回取到的CQE数量
+int IoUring::Wait(int timeoutMs)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if(timeoutMs >= 0)
+    {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+    // CQ里已经有事件时只提交不等待
+    unsigned minComplete = (*cqHead_ == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) ? 1 : 0;
+    int ret = Enter_(sqeTail_ - sqeHead_, minComplete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+    sqeHead_ = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(ret < 0 && errno != ETIME && errno != EINTR)
+        return -1;
+
+    events_.clear();
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++)
+        events_.push_back(cqes_[head & *cqMask_]);
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return static_cast<int>(events_.size());
+}
+
+uint64_t IoUring::GetData(size_t i) const
+{
+    assert(i < events_.size());
+    return events_[i].user_data;
+}
+
+int IoUring::GetRes(size_t i) const
+{
+    assert(i < events_.size());
+    return events_[i].res;
+}
+
+uint32_t IoUring::GetFlags(size_t i) const
+{
+    assert(i < events_.size());
+    return events_[i].flags;
+}
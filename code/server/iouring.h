@@ -0,0 +1,86 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <signal.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#include "../pool/affinity.h"
+
+using namespace std;
+
+// 直接基于io_uring系统调用的轻量封装，接口风格与Epoller保持一致：
+// 先Prep*填充SQE，Wait()一次系统调用提交全部SQE并等待完成事件，再按下标读取CQE
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries = 4096, unsigned bufCount = 1024, unsigned bufSize = 4096);
+    ~IoUring();
+
+    bool Init();                                    // 内核不支持时返回false，调用方回退到epoll
+
+    void PrepAcceptMultishot(int fd, uint64_t data);
+    void PrepRecvMultishot(int fd, uint64_t data);  // 从提供的缓冲区组中取缓冲区
+    void PrepRead(int fd, void* buf, unsigned len, uint64_t data);
+    void PrepWritev(int fd, const struct iovec* iov, int iovCnt, uint64_t data);
+    void PrepPollAdd(int fd, uint32_t events, uint64_t data);  // events为POLLIN/POLLOUT等，完成事件的res为就绪的事件
+    void PrepCancel(uint64_t target, uint64_t data);  // 取消user_data为target的在途请求
+
+    int Wait(int timeoutMs = -1);
+    uint64_t GetData(size_t i) const;
+    int GetRes(size_t i) const;
+    uint32_t GetFlags(size_t i) const;
+
+    char* GetBuffer(uint16_t bid);
+    void RecycleBuffer(uint16_t bid);               // 数据取走后把缓冲区还给内核
+    void BindNode(int node);                        // 把接收缓冲区迁到reactor所在的NUMA节点
+
+private:
+    struct io_uring_sqe* GetSqe_();
+    int Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg);
+    bool SetupBufRing_();
+
+    static const int BUF_GROUP = 0;
+
+    unsigned entries_;
+    int ringFd_;
+
+    // SQ
+    void* sqRing_;
+    size_t sqRingSize_;
+    struct io_uring_sqe* sqes_;
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    unsigned sqeTail_;                              // 本地尾指针，Wait()时才发布给内核
+    unsigned sqeHead_;
+
+    // CQ
+    void* cqRing_;
+    size_t cqRingSize_;
+    struct io_uring_cqe* cqes_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+
+    // 提供给内核的接收缓冲区环
+    struct io_uring_buf_ring* bufRing_;
+    size_t bufRingSize_;
+    unsigned bufCount_;
+    unsigned bufSize_;
+    vector<char> bufPool_;
+
+    vector<struct io_uring_cqe> events_;            // 本轮取出的完成事件
+};
+
+#endif
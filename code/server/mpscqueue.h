@@ -0,0 +1,86 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <assert.h>
+#include <stddef.h>
+
+using namespace std;
+
+// 有界无锁队列，多个工作线程生产，reactor线程消费
+// 每个槽带一个序号：seq == pos 表示可写，seq == pos + 1 表示可读，生产者之间只在tail上CAS
+template<typename T>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(size_t capacity);            // 容量向上取整到2的幂
+    ~MpscQueue() = default;
+
+    bool Push(const T& item);                       // 队列满返回false
+    bool Pop(T& item);                              // 只能由消费者线程调用
+
+private:
+    struct alignas(64) Cell
+    {
+        atomic<size_t> seq;
+        T data;
+    };
+
+    vector<Cell> cells_;
+    size_t mask_;
+    alignas(64) atomic<size_t> tail_;               // 生产者
+    alignas(64) size_t head_;                       // 消费者
+};
+
+template<typename T>
+MpscQueue<T>::MpscQueue(size_t capacity): tail_(0), head_(0)
+{
+    assert(capacity > 0);
+    size_t size = 1;
+    while(size < capacity)
+        size <<= 1;
+    cells_ = vector<Cell>(size);
+    for(size_t i = 0; i < size; i++)
+        cells_[i].seq.store(i, memory_order_relaxed);
+    mask_ = size - 1;
+}
+
+template<typename T>
+bool MpscQueue<T>::Push(const T& item)
+{
+    size_t pos = tail_.load(memory_order_relaxed);
+    while(true)
+    {
+        Cell& cell = cells_[pos & mask_];
+        size_t seq = cell.seq.load(memory_order_acquire);
+        ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+        if(diff == 0)
+        {
+            if(tail_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                cell.data = item;
+                cell.seq.store(pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0)
+            return false;                           // 消费者还没取走，队列满
+        else
+            pos = tail_.load(memory_order_relaxed);
+    }
+}
+
+template<typename T>
+bool MpscQueue<T>::Pop(T& item)
+{
+    Cell& cell = cells_[head_ & mask_];
+    if(cell.seq.load(memory_order_acquire) != head_ + 1)
+        return false;
+    item = cell.data;
+    cell.seq.store(head_ + mask_ + 1, memory_order_release);
+    head_++;
+    return true;
+}
+
+#endif
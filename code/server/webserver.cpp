@@ -0,0 +1,1064 @@
+#include "webserver.h"
+
+using namespace std;
+
+const char WebServer::BUSY_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Connection: close\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+WebServer::WebServer(
+    int port, int trigMode, int timeoutMS, bool OptLinger,
+    int sqlPort, const char* sqlUser, const char* sqlPwd,
+    const char* dbName, int connPoolNum, int threadNum,
+    bool openLog, int logLevel, int logQueSize,
+    int subReactorNum, int dispatchMode, bool reusePort, int ioEngine,
+    int admitPolicy, int maxConn, int maxQueue, bool runInline, int pinMode, int asyncSqlNum,
+    int userCacheSize, bool userFilter, int connPoolMax, int connWaitMS, bool connLease, const char* userStoreFile):
+    port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false), reusePort_(reusePort),
+    dispatchMode_(dispatchMode), ioEngine_(ioEngine), admitPolicy_(admitPolicy),
+    maxConn_((maxConn > 0 && maxConn < MAX_FD) ? maxConn : MAX_FD), maxQueue_(maxQueue > 0 ? maxQueue : 0), admitting_(0),
+    runInline_(runInline), pinMode_(pinMode), nextReactor_(0),
+    threadpool_(new ThreadPool(threadNum, [pinMode, base = subReactorNum + 1, connLease](int i)
+    {
+        Affinity::PinThread(pinMode, base + i);
+        if(connLease)
+            SqlConnPool::BindThread();
+    })), mainReactor_(new Reactor())
+{
+    assert(subReactorNum >= 0);
+    srcDir_ = getcwd(nullptr, 256);
+    assert(srcDir_);
+    strncat(srcDir_, "/resources/", 16);
+    HttpConn::userCount = 0;
+    HttpConn::srcDir = srcDir_;
+    if(userStoreFile)
+    {
+        fileStore_.reset(new FileUserStore());
+        if(!fileStore_->Open(userStoreFile))
+            isClose_ = true;
+        UserStore::Use(fileStore_.get());
+        asyncSqlNum = 0;                                // 异步连接只用于MySQL引擎
+    }
+    else
+    {
+        UserStore::Use(nullptr);
+        SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum, connPoolMax, connWaitMS);
+    }
+    UserCache::Instance()->Init(userCacheSize > 0 ? userCacheSize : 0);
+    if(!userFilter || !UserFilter::Instance()->Load(UserStore::Instance()))
+        UserFilter::Instance()->Init(0);
+
+    InitEventMode_(trigMode);
+    mainReactor_->index = 0;
+    if(!InitReactor_(mainReactor_.get()))
+        isClose_ = true;
+    for(int i = 0; i < subReactorNum && !isClose_; i++)
+    {
+        subReactors_.emplace_back(new Reactor());
+        subReactors_.back()->index = i + 1;
+        if(!InitReactor_(subReactors_.back().get()))
+            isClose_ = true;
+    }
+    if(reusePort_ && !subReactors_.empty())
+    {
+        // 每个子reactor一个监听socket，主reactor不再参与accept
+        for(auto& reactor : subReactors_)
+        {
+            if(!isClose_ && !InitSocket_(reactor.get()))
+                isClose_ = true;
+        }
+    }
+    else if(!isClose_ && !InitSocket_(mainReactor_.get()))
+        isClose_ = true;
+    HttpRequest::asyncDb = false;
+    if(!isClose_ && asyncSqlNum > 0)
+        HttpRequest::asyncDb = InitAsyncSql_(sqlPort, sqlUser, sqlPwd, dbName, asyncSqlNum);
+
+    if(openLog)
+    {
+        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+        cpu_set_t logCpus;
+        if(Affinity::CpuSetFor(pinMode_, subReactorNum + threadNum + 1, &logCpus))
+            Log::Instance()->SetAffinity(logCpus);
+        if(isClose_)
+        {
+            LOG_ERROR("========== Server init error!==========");
+        }
+        else
+        {
+            LOG_INFO("========== Server init ==========");
+            LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
+            LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
+                        (listenEvent_ & EPOLLET ? "ET": "LT"),
+                        (connEvent_ & EPOLLET ? "ET": "LT"));
+            LOG_INFO("SubReactor num: %d, Dispatch Mode: %s, ReusePort: %s", subReactorNum,
+                        (dispatchMode_ == LEAST_LOADED ? "LeastLoaded" : "RoundRobin"),
+                        reusePort_ ? "true" : "false");
+            LOG_INFO("IO Engine: %s", mainReactor_->uring ? "io_uring" : "epoll");
+            if(ioEngine_ == ENGINE_IO_URING && !mainReactor_->uring)
+                LOG_WARN("io_uring unavailable, fall back to epoll");
+            LOG_INFO("Process Mode: %s", runInline_ ? "Inline" : "ThreadPool");
+            LOG_INFO("Async Sql: %s, conn num per reactor: %d", HttpRequest::asyncDb ? "true" : "false", asyncSqlNum);
+            if(asyncSqlNum > 0 && !HttpRequest::asyncDb)
+                LOG_WARN("Async sql unavailable, fall back to thread pool");
+            LOG_INFO("Pin Mode: %s, NUMA nodes: %d",
+                        (pinMode_ == Affinity::PIN_CORE ? "Core" : (pinMode_ == Affinity::PIN_NODE ? "Node" : "None")),
+                        Affinity::NodeCount());
+            LOG_INFO("Admit Policy: %s, MaxConn: %d, MaxQueue: %d",
+                        (admitPolicy_ == ADMIT_PAUSE ? "Pause" : "Reject"), maxConn_, (int)maxQueue_);
+            LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("srcDir: %s", HttpConn::srcDir);
+            LOG_INFO("SqlConnPool num: %d, max: %d, wait: %dms, ThreadPool num: %d", connPoolNum,
+                        connPoolMax > connPoolNum ? connPoolMax : connPoolNum, connWaitMS, threadNum);
+            LOG_INFO("SqlConnPool lease per worker: %s", connLease ? "true" : "false");
+            LOG_INFO("User store: %s%s%s", UserStore::Instance()->Name(), userStoreFile ? " " : "",
+                        userStoreFile ? userStoreFile : "");
+            LOG_INFO("UserCache size: %d, UserFilter: %s", userCacheSize, UserFilter::Instance()->Enabled() ? "true" : "false");
+        }
+    }
+}
+
+WebServer::~WebServer()
+{
+    isClose_ = true;
+    // 唤醒并回收所有子reactor线程
+    for(auto& reactor : subReactors_)
+    {
+        Wakeup_(reactor.get());
+        if(reactor->loop.joinable())
+            reactor->loop.join();
+    }
+    threadpool_.reset();            // 等待工作线程处理完手上的连接，之后才能释放reactor
+    for(auto& reactor : subReactors_)
+    {
+        close(reactor->listenFd);
+        close(reactor->wakeupFd);
+    }
+    close(mainReactor_->listenFd);
+    close(mainReactor_->wakeupFd);
+    free(srcDir_);
+    HttpRequest::asyncDb = false;
+    if(UserCache::Instance()->Enabled())
+        LOG_INFO("UserCache hits: %llu, misses: %llu", (unsigned long long)UserCache::Instance()->Hits(),
+                 (unsigned long long)UserCache::Instance()->Misses());
+    if(UserFilter::Instance()->Enabled())
+        LOG_INFO("UserFilter skipped queries: %llu", (unsigned long long)UserFilter::Instance()->Skips());
+    SqlConnPool::Stats sqlStats = SqlConnPool::Instance()->GetStats();
+    LOG_INFO("SqlConnPool acquires: %llu, waits: %llu, timeouts: %llu, avg wait: %lluus, max wait: %lluus, "
+             "reconnects: %llu, grows: %llu, shrinks: %llu, open: %d, peak busy: %d",
+             (unsigned long long)sqlStats.acquires, (unsigned long long)sqlStats.waits,
+             (unsigned long long)sqlStats.timeouts,
+             (unsigned long long)(sqlStats.waits ? sqlStats.waitUs / sqlStats.waits : 0),
+             (unsigned long long)sqlStats.maxWaitUs, (unsigned long long)sqlStats.reconnects,
+             (unsigned long long)sqlStats.grows, (unsigned long long)sqlStats.shrinks, sqlStats.open, sqlStats.peakBusy);
+    SqlConnPool::Instance()->ClosePool();
+    UserStore::Use(nullptr);
+}
+
+void WebServer::InitEventMode_(int trigMode)
+{
+    listenEvent_ = EPOLLRDHUP;
+    connEvent_ = EPOLLONESHOT | EPOLLRDHUP;
+    switch(trigMode)
+    {
+    case 0:
+        break;
+    case 1:
+        connEvent_ |= EPOLLET;
+        break;
+    case 2:
+        listenEvent_ |= EPOLLET;
+        break;
+    case 3:
+        listenEvent_ |= EPOLLET;
+        connEvent_ |= EPOLLET;
+        break;
+    default:
+        listenEvent_ |= EPOLLET;
+        connEvent_ |= EPOLLET;
+        break;
+    }
+    HttpConn::isET = (connEvent_ & EPOLLET);
+}
+
+// 创建reactor的epoller(或io_uring)、定时器以及唤醒用的eventfd
+bool WebServer::InitReactor_(Reactor* reactor)
+{
+    assert(reactor);
+    reactor->epoller.reset(new Epoller());
+    if(ioEngine_ == ENGINE_IO_URING)
+    {
+        reactor->uring.reset(new IoUring());
+        if(!reactor->uring->Init())
+            reactor->uring.reset();             // 内核不支持，回退到epoll
+    }
+    reactor->timer.reset(new HeapTimer());
+    reactor->users.reset(new ConnSlab(MAX_FD));
+    reactor->connCount = 0;
+    reactor->done.reset(new MpscQueue<Completion>(MAX_FD));     // EPOLLONESHOT下每个连接最多一个在途任务，不会满
+    reactor->wakePending = false;
+    reactor->listenFd = -1;
+    reactor->listenPaused = false;
+    reactor->acceptGen = 0;
+    reactor->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(reactor->wakeupFd < 0)
+    {
+        LOG_ERROR("Create eventfd error!");
+        return false;
+    }
+    if(!reactor->uring && !reactor->epoller->AddFd(reactor->wakeupFd, EPOLLIN))
+    {
+        LOG_ERROR("Add eventfd error!");
+        close(reactor->wakeupFd);
+        reactor->wakeupFd = -1;
+        return false;
+    }
+    return true;
+}
+
+// 每个reactor一个异步连接池，连接的socket注册到该reactor；有一个失败就全部不用，回退到线程池
+bool WebServer::InitAsyncSql_(int sqlPort, const char* sqlUser, const char* sqlPwd, const char* dbName, int connNum)
+{
+    vector<Reactor*> reactors = {mainReactor_.get()};
+    for(auto& reactor : subReactors_)
+        reactors.push_back(reactor.get());
+    for(Reactor* reactor : reactors)
+    {
+        reactor->sql.reset(new AsyncSqlPool([this, reactor](int fd, int events, int timeoutMS)
+        {
+            WatchSql_(reactor, fd, events, timeoutMS);
+        }));
+        bool ok = reactor->sql->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connNum);
+        for(int fd : reactor->sql->Fds())
+        {
+            // epoll下先以空事件注册，等待时再用ModFd打开
+            if(ok && !reactor->uring && !reactor->epoller->AddFd(fd, EPOLLONESHOT, SQL_TAG))
+                ok = false;
+        }
+        if(!ok)
+        {
+            for(Reactor* r : reactors)
+                r->sql.reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+void WebServer::Start()
+{
+    if(!isClose_)
+        LOG_INFO("========== Server start ==========");
+    for(auto& reactor : subReactors_)
+        reactor->loop = thread(&WebServer::Loop_, this, reactor.get());
+    Loop_(mainReactor_.get());
+}
+
+// 可以在其他线程调用，让Start()返回
+void WebServer::Stop()
+{
+    isClose_ = true;
+    Wakeup_(mainReactor_.get());
+    for(auto& reactor : subReactors_)
+        Wakeup_(reactor.get());
+}
+
+// 事件循环，每个reactor在自己的线程里运行
+void WebServer::Loop_(Reactor* reactor)
+{
+    // 先绑核，再把只属于本reactor的内存迁到所在节点：连接槽(含连接的缓冲区和arena)、io_uring接收缓冲区
+    if(Affinity::PinThread(pinMode_, reactor->index))
+    {
+        int node = Affinity::CurrentNode();
+        reactor->users->BindNode(node);
+        if(reactor->uring)
+            reactor->uring->BindNode(node);
+    }
+    if(reactor->uring)
+    {
+        UringLoop_(reactor);
+        return;
+    }
+    int timeMS = -1;        // epoll wait timeout == -1 无事件将阻塞
+    while(!isClose_)
+    {
+        timeMS = reactor->timer->GetNextTick();     // 没有连接超时，也可能有数据库语句的超时
+        if(reactor->listenPaused)
+        {
+            if(!Overloaded_(true))
+                ResumeListen_(reactor);
+            else if(timeMS < 0 || timeMS > PAUSE_CHECK_MS)
+                timeMS = PAUSE_CHECK_MS;
+        }
+        int eventCnt = reactor->epoller->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++)
+        {
+            // 处理事件
+            int fd = reactor->epoller->GetEventFd(i);
+            uint32_t events = reactor->epoller->GetEvents(i);
+            if(fd == reactor->listenFd)
+                DealListen_(reactor);
+            else if(fd == reactor->wakeupFd)
+                DealWakeup_(reactor);
+            else if(reactor->epoller->GetEventTag(i) == SQL_TAG)
+                DealSql_(reactor, fd, events);
+            else
+            {
+                // 代数不符说明是fd被复用前旧连接残留的事件，直接丢弃
+                ConnSlab::Slot* slot = reactor->users->Get(fd, reactor->epoller->GetEventTag(i));
+                if(!slot)
+                    continue;
+                if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    CloseConn_(reactor, slot->Conn());
+                else if(events & EPOLLIN)
+                    DealRead_(reactor, slot->Conn());
+                else if(events & EPOLLOUT)
+                    DealWrite_(reactor, slot->Conn());
+                else
+                    LOG_ERROR("Unexpected event");
+            }
+        }
+    }
+}
+
+void WebServer::Wakeup_(Reactor* reactor)
+{
+    uint64_t one = 1;
+    if(::write(reactor->wakeupFd, &one, sizeof(one)) != sizeof(one))
+        LOG_WARN("Wakeup reactor error!");
+}
+
+// 取出主reactor分发过来的连接，在本线程中注册；再批量处理工作线程交回的完成事件
+void WebServer::DealWakeup_(Reactor* reactor)
+{
+    uint64_t cnt = 0;
+    ::read(reactor->wakeupFd, &cnt, sizeof(cnt));
+    reactor->wakePending = false;                   // 先清标志再取队列，之后入队的会重新唤醒
+
+    vector<pair<int, sockaddr_in>> pending;
+    {
+        lock_guard<mutex> locker(reactor->mtx);
+        pending.swap(reactor->pending);
+    }
+    for(auto& item : pending)
+    {
+        RegisterClient_(reactor, item.first, item.second);
+        admitting_--;                               // 注册后已计入userCount
+    }
+
+    Completion comp;
+    while(reactor->done->Pop(comp))
+    {
+        ConnSlab::Slot* slot = reactor->users->Get(comp.fd, comp.gen);
+        if(!slot || slot->Conn()->IsClose())
+            continue;
+        HttpConn* client = slot->Conn();
+        switch(comp.type)
+        {
+        case COMP_READ:
+            reactor->epoller->ModFd(comp.fd, connEvent_ | EPOLLIN, comp.gen);
+            break;
+        case COMP_WRITE:
+            OnWrite_(reactor, client);
+            break;
+        case COMP_ASYNC:
+            StartAsync_(reactor, client);
+            break;
+        case COMP_BLOCKING:
+            slot->working = false;
+            if(slot->closing)
+                CloseConn_(reactor, client);        // 处理期间连接超时或出错，现在才能关闭fd
+            else
+            {
+                client->FinishBlocking();
+                UringProcess_(reactor, client);
+            }
+            break;
+        default:
+            CloseConn_(reactor, client);
+            break;
+        }
+    }
+}
+
+// 工作线程调用，把后续动作交回连接所属的reactor，不直接操作epoll
+// gen是投递任务时连接的代数，期间连接关闭、fd被复用时reactor据此丢弃
+void WebServer::Complete_(Reactor* reactor, HttpConn* client, uint32_t gen, int type)
+{
+    Completion comp = {client->GetFd(), gen, type};
+    while(!reactor->done->Push(comp))
+        this_thread::yield();
+    if(!reactor->wakePending.exchange(true))
+        Wakeup_(reactor);
+}
+
+void WebServer::SendError_(int fd, const char* info)
+{
+    assert(fd > 0);
+    int ret = send(fd, info, strlen(info), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(ret < 0)
+        LOG_WARN("send error to client[%d] error!", fd);
+    close(fd);
+}
+
+// io_uring下本轮准备的writev、recv可能还没提交，这时关闭的fd会被multishot accept立即复用，请求就落到了新连接上；
+// 所以先shutdown结束挂在fd上的recv和writev，等它们的完成事件都回来后再次调用本函数时才真正关闭
+void WebServer::CloseConn_(Reactor* reactor, HttpConn* client)
+{
+    assert(client);
+    if(client->IsClose())
+        return;
+    if(reactor->uring)
+    {
+        ConnSlab::Slot* slot = reactor->users->At(client->GetFd());
+        if(!slot->closing)
+        {
+            slot->closing = true;
+            LOG_INFO("Client[%d] quit!", client->GetFd());
+            shutdown(client->GetFd(), SHUT_RDWR);
+        }
+        if(slot->recvArmed || slot->writing || slot->working)
+            return;
+    }
+    else
+    {
+        LOG_INFO("Client[%d] quit!", client->GetFd());
+        reactor->epoller->DelFd(client->GetFd());
+    }
+    client->Close();
+    reactor->connCount--;
+}
+
+// 选出接收新连接的子reactor
+WebServer::Reactor* WebServer::NextReactor_()
+{
+    if(subReactors_.empty())
+        return mainReactor_.get();
+    if(dispatchMode_ == LEAST_LOADED)
+    {
+        Reactor* target = subReactors_[0].get();
+        for(auto& reactor : subReactors_)
+        {
+            if(reactor->connCount < target->connCount)
+                target = reactor.get();
+        }
+        return target;
+    }
+    Reactor* target = subReactors_[nextReactor_].get();
+    nextReactor_ = (nextReactor_ + 1) % subReactors_.size();
+    return target;
+}
+
+// acceptor为执行accept的reactor，SO_REUSEPORT模式下连接直接留在acceptor上
+void WebServer::AddClient_(Reactor* acceptor, int fd, sockaddr_in addr)
+{
+    assert(fd > 0);
+    Reactor* reactor = reusePort_ ? acceptor : NextReactor_();
+    reactor->connCount++;
+    if(reactor == acceptor)
+    {
+        RegisterClient_(reactor, fd, addr);
+        return;
+    }
+    // 连接表和定时器只能由所属的reactor线程操作，这里只负责投递
+    admitting_++;
+    {
+        lock_guard<mutex> locker(reactor->mtx);
+        reactor->pending.emplace_back(fd, addr);
+    }
+    Wakeup_(reactor);
+}
+
+void WebServer::RegisterClient_(Reactor* reactor, int fd, sockaddr_in addr)
+{
+    assert(fd > 0 && fd < MAX_FD);
+    ConnSlab::Slot* slot = reactor->users->Acquire(fd);
+    HttpConn* client = slot->Conn();
+    client->init(fd, addr);
+    client->DeferBlocking(reactor->uring != nullptr);
+    if(timeoutMS_ > 0)
+    {
+        // 连接可能已经关闭，fd也可能又被本reactor复用，残留的定时器按代数确认后才关闭
+        reactor->timer->add(fd, timeoutMS_, [this, reactor, fd, gen = slot->gen]()
+        {
+            ConnSlab::Slot* slot = reactor->users->Get(fd, gen);
+            if(slot)
+                CloseConn_(reactor, slot->Conn());
+        });
+    }
+    if(reactor->uring)
+    {
+        reactor->uring->PrepRecvMultishot(fd, UringData_(OP_RECV, slot->gen, fd));
+        slot->recvArmed = true;
+    }
+    else
+        reactor->epoller->AddFd(fd, EPOLLIN | connEvent_, slot->gen);
+    LOG_INFO("Client[%d] in!", client->GetFd());
+}
+
+// 每次可读事件尽量把backlog取空，过载时按准入策略拒绝或暂停accept
+// 每接收一个连接都重新判断过载，投递出去还没注册的连接由admitting_计入，一批accept不会超过maxConn
+void WebServer::DealListen_(Reactor* reactor)
+{
+    struct sockaddr_in addr;
+    bool overload = Overloaded_(false);
+    int rejected = 0;
+    for(int i = 0; (listenEvent_ & EPOLLET) || i < ACCEPT_BATCH; i++)
+    {
+        if(overload && admitPolicy_ == ADMIT_PAUSE)
+        {
+            PauseListen_(reactor);
+            break;
+        }
+        socklen_t len = sizeof(addr);
+        int fd = accept4(reactor->listenFd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                LOG_WARN("Accept error: %d", errno);
+            break;
+        }
+        if(overload || fd >= MAX_FD)        // 连接槽按fd下标，fd不能越界
+        {
+            SendError_(fd, BUSY_RESPONSE);
+            rejected++;
+            continue;
+        }
+        AddClient_(reactor, fd, addr);
+        overload = Overloaded_(false);
+    }
+    if(rejected > 0)
+        LOG_WARN("Server busy, reject %d clients", rejected);
+}
+
+// resume为true时使用低水位，暂停后负载降到90%以下才恢复，避免在阈值附近反复切换
+bool WebServer::Overloaded_(bool resume)
+{
+    int connLimit = resume ? maxConn_ - maxConn_ / 10 : maxConn_;
+    if(HttpConn::userCount + admitting_ >= connLimit)
+        return true;
+    if(maxQueue_ > 0)
+    {
+        size_t queueLimit = resume ? maxQueue_ - maxQueue_ / 10 : maxQueue_;
+        if(threadpool_->TaskCount() >= queueLimit)
+            return true;
+    }
+    return false;
+}
+
+// 停止从监听socket取连接，新连接留在内核backlog中，backlog满后由内核拒绝
+void WebServer::PauseListen_(Reactor* reactor)
+{
+    if(reactor->listenPaused)
+        return;
+    reactor->listenPaused = true;
+    if(reactor->uring)
+        reactor->uring->PrepCancel(UringData_(OP_ACCEPT, reactor->acceptGen, reactor->listenFd), UringData_(OP_CANCEL, 0, 0));
+    else
+        reactor->epoller->ModFd(reactor->listenFd, listenEvent_);
+    LOG_WARN("Server overload, pause accept on listen fd %d", reactor->listenFd);
+}
+
+void WebServer::ResumeListen_(Reactor* reactor)
+{
+    if(!reactor->listenPaused)
+        return;
+    reactor->listenPaused = false;
+    if(reactor->uring)
+    {
+        reactor->acceptGen = (reactor->acceptGen + 1) & ConnSlab::GEN_MASK;
+        reactor->uring->PrepAcceptMultishot(reactor->listenFd, UringData_(OP_ACCEPT, reactor->acceptGen, reactor->listenFd));
+    }
+    else
+        reactor->epoller->ModFd(reactor->listenFd, listenEvent_ | EPOLLIN);    // MOD会重新检查就绪状态，backlog中的连接不会丢
+    LOG_INFO("Server load drop, resume accept on listen fd %d", reactor->listenFd);
+}
+
+void WebServer::DealRead_(Reactor* reactor, HttpConn* client)
+{
+    assert(client);
+    ExtentTime_(reactor, client);
+    uint32_t gen = reactor->users->At(client->GetFd())->gen;
+    if(!runInline_)
+    {
+        threadpool_->AddTask(bind(&WebServer::OnRead_, this, reactor, client, gen));
+        return;
+    }
+    // 内联模式：在reactor线程读取并处理，只有可能阻塞的请求交给线程池
+    int readErrno = 0;
+    int ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN)
+    {
+        CloseConn_(reactor, client);
+        return;
+    }
+    if(client->MayBlock())
+        threadpool_->AddTask(bind(&WebServer::OnProcess, this, reactor, client, gen));
+    else
+        OnProcessInline_(reactor, client);
+}
+
+void WebServer::DealWrite_(Reactor* reactor, HttpConn* client)
+{
+    assert(client);
+    ExtentTime_(reactor, client);
+    OnWrite_(reactor, client);                  // 非阻塞写，始终在reactor线程完成
+}
+
+void WebServer::ExtentTime_(Reactor* reactor, HttpConn* client)
+{
+    assert(client);
+    if(timeoutMS_ > 0)
+        reactor->timer->adjust(client->GetFd(), timeoutMS_);
+}
+
+void WebServer::OnRead_(Reactor* reactor, HttpConn* client, uint32_t gen)
+{
+    assert(client);
+    int ret = -1;
+    int readErrno = 0;
+    ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN)
+    {
+        Complete_(reactor, client, gen, COMP_CLOSE);
+        return;
+    }
+    OnProcess(reactor, client, gen);
+}
+
+// 在工作线程中执行
+void WebServer::OnProcess(Reactor* reactor, HttpConn* client, uint32_t gen)
+{
+    if(client->process())
+        Complete_(reactor, client, gen, COMP_WRITE);
+    else
+        Complete_(reactor, client, gen, client->NeedAsync() ? COMP_ASYNC : COMP_READ);
+}
+
+// 响应生成后直接尝试写出，socket发送缓冲区有空间时不必再等一轮EPOLLOUT
+void WebServer::OnProcessInline_(Reactor* reactor, HttpConn* client)
+{
+    if(client->process())
+        OnWrite_(reactor, client);
+    else if(client->NeedAsync())
+        StartAsync_(reactor, client);
+    else
+        reactor->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, reactor->users->At(client->GetFd())->gen);
+}
+
+// 在reactor线程中发起异步处理，等待期间epoll不关注该连接(EPOLLONESHOT未重新注册)；
+// 完成时连接可能已经超时关闭甚至fd被复用，按代数确认后再继续
+// io_uring下没有异步处理函数的登录/注册也停在这里；异步连接全部断开时(如数据库重启)改走阻塞的SqlConnPool，
+// 这两种情况都交给线程池，这时查询慢或排队等连接的可能最大，不能占着reactor
+void WebServer::StartAsync_(Reactor* reactor, HttpConn* client)
+{
+    int fd = client->GetFd();
+    uint32_t gen = reactor->users->At(fd)->gen;
+    if(!client->HasAsyncHandler() || !reactor->sql->Available())
+    {
+        PostBlocking_(reactor, client);
+        return;
+    }
+    client->StartAsync(reactor->sql.get(), [this, reactor, fd, gen](string_view path)
+    {
+        ConnSlab::Slot* slot = reactor->users->Get(fd, gen);
+        if(!slot || slot->Conn()->IsClose() || slot->closing)
+            return;
+        HttpConn* client = slot->Conn();
+        client->FinishAsync(path);
+        if(reactor->uring)
+            UringProcess_(reactor, client);
+        else
+            OnProcessInline_(reactor, client);
+    });
+}
+
+// 在工作线程执行等待中请求的阻塞处理函数。epoll下连接不在epoll中，工作线程接着生成响应；
+// io_uring下reactor还在往stash_里收数据，工作线程只执行处理函数，结果经完成队列交回reactor，
+// 在此之前连接即使超时也不关闭fd，请求引用的读缓冲和arena保持有效
+void WebServer::PostBlocking_(Reactor* reactor, HttpConn* client)
+{
+    ConnSlab::Slot* slot = reactor->users->At(client->GetFd());
+    uint32_t gen = slot->gen;
+    client->StartBlocking();
+    if(reactor->uring)
+    {
+        slot->working = true;
+        threadpool_->AddTask([this, reactor, client, gen]()
+        {
+            client->RunBlocking();
+            Complete_(reactor, client, gen, COMP_BLOCKING);
+        });
+    }
+    else
+    {
+        threadpool_->AddTask([this, reactor, client, gen]()
+        {
+            client->RunBlocking();
+            client->FinishBlocking();
+            OnProcess(reactor, client, gen);
+        });
+    }
+}
+
+// 把AsyncSqlPool要等待的事件翻译成epoll/poll事件，都只触发一次；超时用reactor的定时器，以fd为id
+void WebServer::WatchSql_(Reactor* reactor, int fd, int events, int timeoutMS)
+{
+    uint32_t ev = 0;
+    if(events & AsyncSqlPool::WAIT_READ)
+        ev |= EPOLLIN;
+    if(events & AsyncSqlPool::WAIT_WRITE)
+        ev |= EPOLLOUT;
+    if(events & AsyncSqlPool::WAIT_EXCEPT)
+        ev |= EPOLLPRI;
+    if(reactor->uring)
+    {
+        if(ev)
+            reactor->uring->PrepPollAdd(fd, ev, UringData_(OP_SQL, 0, fd));
+    }
+    else if(!reactor->epoller->ModFd(fd, ev | EPOLLONESHOT, SQL_TAG) && ev)
+        reactor->epoller->AddFd(fd, ev | EPOLLONESHOT, SQL_TAG);       // 重连后的新socket
+    if(events & AsyncSqlPool::WAIT_TIMEOUT)
+    {
+        reactor->timer->add(fd, timeoutMS, [reactor, fd]()
+        {
+            if(reactor->sql)
+                reactor->sql->OnEvent(fd, AsyncSqlPool::WAIT_TIMEOUT);
+        });
+    }
+}
+
+// 挂断和出错当作可读可写，交给客户端库读出错误
+void WebServer::DealSql_(Reactor* reactor, int fd, uint32_t events)
+{
+    int ready = 0;
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        ready |= AsyncSqlPool::WAIT_READ;
+    if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        ready |= AsyncSqlPool::WAIT_WRITE;
+    if(events & EPOLLPRI)
+        ready |= AsyncSqlPool::WAIT_EXCEPT;
+    if(ready && reactor->sql)
+        reactor->sql->OnEvent(fd, ready);
+}
+
+void WebServer::OnWrite_(Reactor* reactor, HttpConn* client)
+{
+    assert(client);
+    int ret = -1;
+    int writeErrno = 0;
+    ret = client->write(&writeErrno);
+    if(client->ToWriteBytes() == 0)
+    {
+        // 传输完成
+        if(client->IsKeepAlive())
+        {
+            // 读缓冲里可能还有流水线请求：线程池模式下都交给工作线程，内联模式下只有查数据库的才交出去
+            uint32_t gen = reactor->users->At(client->GetFd())->gen;
+            if(runInline_ && !client->MayBlock())
+                OnProcessInline_(reactor, client);
+            else if(client->BufferedBytes() > 0)
+                threadpool_->AddTask(bind(&WebServer::OnProcess, this, reactor, client, gen));
+            else
+                reactor->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, gen);
+            return;
+        }
+    }
+    else if(ret > 0 || writeErrno == EAGAIN)
+    {
+        // 继续传输(LT模式下write()写出一部分就会返回)
+        reactor->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, reactor->users->At(client->GetFd())->gen);
+        return;
+    }
+    CloseConn_(reactor, client);
+}
+
+// user_data: 高8位操作类型 | 24位连接代数 | 低32位fd
+uint64_t WebServer::UringData_(int op, uint32_t gen, int fd)
+{
+    return (static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(gen & 0xffffff) << 32) | static_cast<uint32_t>(fd);
+}
+
+// io_uring事件循环：accept、recv、send都以完成事件的形式返回，
+// 本轮产生的SQE在下一次Wait()时一次性提交，请求在reactor线程内直接处理，只有登录/注册这类会阻塞的交给线程池
+void WebServer::UringLoop_(Reactor* reactor)
+{
+    IoUring* ring = reactor->uring.get();
+    if(reactor->listenFd >= 0)
+        ring->PrepAcceptMultishot(reactor->listenFd, UringData_(OP_ACCEPT, reactor->acceptGen, reactor->listenFd));
+    ring->PrepRead(reactor->wakeupFd, &reactor->wakeupCnt, sizeof(reactor->wakeupCnt), UringData_(OP_WAKEUP, 0, reactor->wakeupFd));
+
+    int timeMS = -1;
+    while(!isClose_)
+    {
+        timeMS = reactor->timer->GetNextTick();
+        if(reactor->listenPaused)
+        {
+            if(!Overloaded_(true))
+                ResumeListen_(reactor);
+            else if(timeMS < 0 || timeMS > PAUSE_CHECK_MS)
+                timeMS = PAUSE_CHECK_MS;
+        }
+        int eventCnt = ring->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++)
+        {
+            uint64_t data = ring->GetData(i);
+            int op = static_cast<int>(data >> 56);
+            uint32_t gen = static_cast<uint32_t>(data >> 32) & 0xffffff;
+            int fd = static_cast<int>(static_cast<uint32_t>(data));
+            switch(op)
+            {
+            case OP_ACCEPT:
+                DealUringAccept_(reactor, gen, ring->GetRes(i), ring->GetFlags(i));
+                break;
+            case OP_CANCEL:
+                break;
+            case OP_WAKEUP:
+                DealWakeup_(reactor);
+                ring->PrepRead(reactor->wakeupFd, &reactor->wakeupCnt, sizeof(reactor->wakeupCnt), data);
+                break;
+            case OP_RECV:
+                DealUringRecv_(reactor, fd, gen, ring->GetRes(i), ring->GetFlags(i));
+                break;
+            case OP_SEND:
+                DealUringSend_(reactor, fd, gen, ring->GetRes(i));
+                break;
+            case OP_SQL:
+            {
+                int res = ring->GetRes(i);      // 就绪的poll事件，出错时为负的errno
+                DealSql_(reactor, fd, res < 0 ? (EPOLLIN | EPOLLOUT) : static_cast<uint32_t>(res));
+                break;
+            }
+            default:
+                LOG_ERROR("Unexpected event");
+                break;
+            }
+        }
+    }
+}
+
+void WebServer::DealUringAccept_(Reactor* reactor, uint32_t gen, int res, uint32_t flags)
+{
+    if(res >= 0)
+    {
+        struct sockaddr_in addr{};               // AF_UNSPEC：对端地址等到日志用到时再取，accept不多一次系统调用
+        if(HttpConn::userCount + admitting_ >= MAX_FD || res >= MAX_FD || (admitPolicy_ == ADMIT_REJECT && Overloaded_(false)))
+        {
+            SendError_(res, BUSY_RESPONSE);
+            LOG_WARN("Server busy, reject client[%d]", res);
+        }
+        else
+        {
+            // 暂停策略下，取消生效前内核已经accept的连接照常接收，一达到上限就取消accept
+            AddClient_(reactor, res, addr);
+            if(admitPolicy_ == ADMIT_PAUSE && Overloaded_(false))
+                PauseListen_(reactor);
+        }
+    }
+    // multishot accept被内核终止后需要重新提交，已被取消的旧请求不再提交
+    if(!(flags & IORING_CQE_F_MORE) && !isClose_ && !reactor->listenPaused && gen == reactor->acceptGen)
+        reactor->uring->PrepAcceptMultishot(reactor->listenFd, UringData_(OP_ACCEPT, gen, reactor->listenFd));
+}
+
+void WebServer::DealUringRecv_(Reactor* reactor, int fd, uint32_t gen, int res, uint32_t flags)
+{
+    IoUring* ring = reactor->uring.get();
+    ConnSlab::Slot* slot = reactor->users->Get(fd, gen);
+    HttpConn* client = slot ? slot->Conn() : nullptr;
+    bool stale = (!slot || client->IsClose());
+    if(flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if(!stale && !slot->closing)
+            client->AppendRead(ring->GetBuffer(bid), res);
+        ring->RecycleBuffer(bid);
+    }
+    if(stale)
+        return;
+
+    if(!(flags & IORING_CQE_F_MORE))
+        slot->recvArmed = false;
+    if(slot->closing)
+    {
+        CloseConn_(reactor, client);        // recv结束后可能就可以关闭fd了
+        return;
+    }
+    // ECANCELED是背压时主动取消的recv
+    if(res <= 0 && res != -ENOBUFS && res != -ECANCELED)
+    {
+        CloseConn_(reactor, client);
+        return;
+    }
+    if(res > 0)
+    {
+        ExtentTime_(reactor, client);
+        if(!slot->writing)
+            UringProcess_(reactor, client);
+    }
+    // 缓冲区暂时用完(ENOBUFS)或内核结束了multishot，按读缓冲的情况重新挂上recv
+    UringRecvFlow_(reactor, slot);
+}
+
+void WebServer::DealUringSend_(Reactor* reactor, int fd, uint32_t gen, int res)
+{
+    ConnSlab::Slot* slot = reactor->users->Get(fd, gen);
+    if(!slot || slot->Conn()->IsClose())
+        return;
+    HttpConn* client = slot->Conn();
+    if(res < 0 || slot->closing)
+    {
+        slot->writing = false;
+        CloseConn_(reactor, client);
+        return;
+    }
+    client->Advance(res);
+    if(res > 0)
+        ExtentTime_(reactor, client);       // 与epoll下每次写一样续期，慢速下载不会在中途超时
+    if(client->ToWriteBytes() > 0)
+    {
+        // 没写完，继续
+        reactor->uring->PrepWritev(fd, client->GetIov(), client->GetIovCnt(), UringData_(OP_SEND, gen, fd));
+        return;
+    }
+    slot->writing = false;
+    if(!client->IsKeepAlive())
+    {
+        CloseConn_(reactor, client);
+        return;
+    }
+    UringProcess_(reactor, client);         // 处理写的过程中收到的数据
+}
+
+void WebServer::UringProcess_(Reactor* reactor, HttpConn* client)
+{
+    if(client->process())
+    {
+        int fd = client->GetFd();
+        ConnSlab::Slot* slot = reactor->users->At(fd);
+        slot->writing = true;
+        reactor->uring->PrepWritev(fd, client->GetIov(), client->GetIovCnt(), UringData_(OP_SEND, slot->gen, fd));
+    }
+    else if(client->NeedAsync())
+        StartAsync_(reactor, client);
+    UringRecvFlow_(reactor, reactor->users->At(client->GetFd()));
+}
+
+// 写响应或等待异步处理期间收到的数据不会被处理，读缓冲(含stash_)超过READ_WINDOW时取消multishot recv，
+// 与epoll下read()攒满窗口就停下一样；process()消费到窗口以下后重新挂上。
+// 取消生效前内核已经收下的数据仍会交付，超出的部分不超过一轮完成事件
+void WebServer::UringRecvFlow_(Reactor* reactor, ConnSlab::Slot* slot)
+{
+    HttpConn* client = slot->Conn();
+    if(client->IsClose() || slot->closing)
+        return;
+    int fd = client->GetFd();
+    uint64_t data = UringData_(OP_RECV, slot->gen, fd);
+    if(client->BufferedBytes() >= HttpConn::READ_WINDOW)
+    {
+        if(!slot->recvPaused && slot->recvArmed)
+            reactor->uring->PrepCancel(data, UringData_(OP_CANCEL, 0, 0));
+        slot->recvPaused = true;
+        return;
+    }
+    slot->recvPaused = false;
+    // 取消还没完成时recv仍算在途，等它最后一个完成事件到达后再挂上
+    if(!slot->recvArmed)
+    {
+        reactor->uring->PrepRecvMultishot(fd, data);
+        slot->recvArmed = true;
+    }
+}
+
+// 创建监听socket，注册到负责accept的reactor
+bool WebServer::InitSocket_(Reactor* reactor)
+{
+    int ret;
+    struct sockaddr_in addr;
+    if(port_ > 65535 || port_ < 1024)
+    {
+        LOG_ERROR("Port:%d error!", port_);
+        return false;
+    }
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+    struct linger optLinger{};
+    if(openLinger_)
+    {
+        // 优雅关闭: 直到所剩数据发送完毕或超时
+        optLinger.l_onoff = 1;
+        optLinger.l_linger = 1;
+    }
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0)
+    {
+        LOG_ERROR("Create socket error!", port_);
+        return false;
+    }
+
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    if(ret < 0)
+    {
+        close(listenFd);
+        LOG_ERROR("Init linger error!", port_);
+        return false;
+    }
+
+    int optval = 1;
+    // 端口复用
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    if(ret == -1)
+    {
+        LOG_ERROR("set socket setsockopt error !");
+        close(listenFd);
+        return false;
+    }
+
+    // 多个socket绑定同一端口，由内核按四元组哈希分散新连接
+    if(reusePort_)
+    {
+        ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1)
+        {
+            LOG_ERROR("set SO_REUSEPORT error !");
+            close(listenFd);
+            return false;
+        }
+    }
+
+    ret = bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));
+    if(ret < 0)
+    {
+        LOG_ERROR("Bind Port:%d error!", port_);
+        close(listenFd);
+        return false;
+    }
+
+    ret = listen(listenFd, SOMAXCONN);
+    if(ret < 0)
+    {
+        LOG_ERROR("Listen port:%d error!", port_);
+        close(listenFd);
+        return false;
+    }
+    ret = reactor->uring ? 1 : reactor->epoller->AddFd(listenFd, listenEvent_ | EPOLLIN);
+    if(ret == 0)
+    {
+        LOG_ERROR("Add listen error!");
+        close(listenFd);
+        return false;
+    }
+    SetFdNonblock(listenFd);
+    reactor->listenFd = listenFd;
+    LOG_INFO("Server port:%d", port_);
+    return true;
+}
+
+int WebServer::SetFdNonblock(int fd)
+{
+    assert(fd > 0);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
@@ -1,74 +1,213 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
-#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "epoller.h"
+#include "iouring.h"
+#include "connslab.h"
+#include "mpscqueue.h"
 #include "../timer/heaptimer.h"
 
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/asyncsql.h"
+#include "../pool/affinity.h"
+#include "../pool/fileuserstore.h"
 
 #include "../http/httpconn.h"
 
 class WebServer
 {
 public:
-    WebServer
+    // 主reactor向子reactor分发连接的方式
+    enum DISPATCH_MODE
     {
+        ROUND_ROBIN,
+        LEAST_LOADED,
+    };
+
+    // I/O引擎，启动时选择，io_uring不可用时回退到epoll
+    enum IO_ENGINE
+    {
+        ENGINE_EPOLL,
+        ENGINE_IO_URING,
+    };
+
+    // 过载时对新连接的处理：直接回503并关闭，或暂停监听socket的EPOLLIN让连接留在内核backlog里
+    enum ADMIT_POLICY
+    {
+        ADMIT_REJECT,
+        ADMIT_PAUSE,
+    };
+
+    // subReactorNum为0时为单reactor模式，所有事件都在Start()所在线程处理
+    // reusePort为true时每个子reactor各自打开一个SO_REUSEPORT监听socket并自己accept，由内核分散连接
+    // pinMode不为PIN_NONE时依次把主reactor、子reactor、工作线程、日志写线程绑到CPU或NUMA节点上，
+    // 主reactor运行在调用Start()的线程
+    // runInline为true时请求在reactor线程内解析并直接写出响应，只有登录/注册这类要查数据库的请求交给线程池
+    // 连接数达到maxConn(0表示MAX_FD)或线程池排队任务数达到maxQueue(0表示不限)时视为过载，按admitPolicy处理新连接
+    // asyncSqlNum大于0时每个reactor另建这么多非阻塞数据库连接，登录/注册在reactor线程中异步查询，不再占用工作线程；
+    // 客户端库不支持时回退到线程池
+    // userCacheSize大于0时在user表前加一层最多这么多用户的登录缓存，重复登录不查库
+    // userFilter为true时启动时读出所有用户名建立布隆过滤器，不存在的用户名不查库(要求本进程是user表唯一的写入者)
+    WebServer(
         int port, int trigMode, int timeoutMS, bool OptLinger,
         int sqlPort, const char* sqlUser, const char* sqlPwd,
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize
-    };
+        bool openLog, int logLevel, int logQueSize,
+        int subReactorNum = 0, int dispatchMode = ROUND_ROBIN, bool reusePort = false,
+        int ioEngine = ENGINE_EPOLL,
+        int admitPolicy = ADMIT_REJECT, int maxConn = 0, int maxQueue = 0,
+        bool runInline = false, int pinMode = Affinity::PIN_NONE, int asyncSqlNum = 0,
+        int userCacheSize = 0, bool userFilter = false, int connPoolMax = 0, int connWaitMS = 1000,
+        bool connLease = false, const char* userStoreFile = nullptr
+    );
 
     ~WebServer();
     void Start();
+    void Stop();
 
 private:
-    bool InitSocket_();
-    void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
+    // io_uring完成事件的类型，编码在user_data的高8位
+    enum URING_OP
+    {
+        OP_ACCEPT = 1,
+        OP_WAKEUP,
+        OP_RECV,
+        OP_SEND,
+        OP_CANCEL,
+        OP_SQL,                                         // 异步数据库连接的poll
+    };
 
-    void DealListen_();
-    void DealWrite_(HttpConn* client);
-    void DealRead_(HttpConn* client);
+    // 工作线程处理完请求后交回reactor的动作
+    enum COMPLETION
+    {
+        COMP_READ,                                      // 重新关注EPOLLIN
+        COMP_WRITE,                                     // 响应已生成，由reactor立即开始写
+        COMP_CLOSE,
+        COMP_ASYNC,                                     // 请求需要异步处理，由reactor发起
+        COMP_BLOCKING,                                  // io_uring: 阻塞的处理函数执行完，由reactor生成响应
+    };
 
-    void SendError_(int fd, const char* info);
-    void ExtentTime_(HttpConn* client);
-    void CloseConn_(HttpConn* client);
+    struct Completion
+    {
+        int fd;
+        uint32_t gen;
+        int type;
+    };
+
+    // 每个reactor独占一个epoller(或io_uring)、定时器和连接槽，只在自己的线程里操作
+    // fd同一时刻只属于一个reactor，连接的事件、定时器和完成事件都回到这个reactor，在它的ConnSlab里查找
+    struct Reactor
+    {
+        unique_ptr<Epoller> epoller;
+        unique_ptr<IoUring> uring;                      // 非空时该reactor使用io_uring
+        unique_ptr<HeapTimer> timer;
+        unique_ptr<ConnSlab> users;                     // 绑核后绑到reactor所在的NUMA节点
+        uint64_t wakeupCnt;                             // io_uring读eventfd的缓冲
+
+        int listenFd;                                   // 该reactor负责accept的监听socket，没有则为-1
+        bool listenPaused;                              // 过载时暂停了accept
+        uint32_t acceptGen;                             // io_uring: 当前multishot accept的代数，取消后的旧请求据此忽略
+        int wakeupFd;                                   // eventfd，用于唤醒阻塞在epoll_wait上的reactor
+        mutex mtx;                                      // 保护pending
+        vector<pair<int, sockaddr_in>> pending;         // 主reactor分发过来，尚未注册的连接
+        atomic<int> connCount;                          // 当前连接数，最少连接分发时使用
+        unique_ptr<MpscQueue<Completion>> done;         // 工作线程交回的完成事件，由reactor批量处理
+        atomic<bool> wakePending;                       // 已写过eventfd且reactor尚未处理，避免重复唤醒
+        thread loop;
+        int index;                                      // 0为主reactor，子reactor从1开始，绑核时使用
+        unique_ptr<AsyncSqlPool> sql;                   // 异步数据库连接，未启用时为空
+    };
+
+    bool InitSocket_(Reactor* reactor);
+    void InitEventMode_(int trigMode);
+    bool InitReactor_(Reactor* reactor);
+    bool InitAsyncSql_(int sqlPort, const char* sqlUser, const char* sqlPwd, const char* dbName, int connNum);
+    void AddClient_(Reactor* acceptor, int fd, sockaddr_in addr);
+    void RegisterClient_(Reactor* reactor, int fd, sockaddr_in addr);
+    Reactor* NextReactor_();
+
+    void Loop_(Reactor* reactor);
+    void UringLoop_(Reactor* reactor);
+    void Wakeup_(Reactor* reactor);
+
+    void DealListen_(Reactor* reactor);
+    bool Overloaded_(bool resume);
+    void PauseListen_(Reactor* reactor);
+    void ResumeListen_(Reactor* reactor);
+    void DealWakeup_(Reactor* reactor);
+    void DealWrite_(Reactor* reactor, HttpConn* client);
+    void DealRead_(Reactor* reactor, HttpConn* client);
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
-    void OnProcess(HttpConn* client);
+    void SendError_(int fd, const char* info);
+    void ExtentTime_(Reactor* reactor, HttpConn* client);
+    void CloseConn_(Reactor* reactor, HttpConn* client);
+
+    void OnRead_(Reactor* reactor, HttpConn* client, uint32_t gen);
+    void OnWrite_(Reactor* reactor, HttpConn* client);
+    void OnProcess(Reactor* reactor, HttpConn* client, uint32_t gen);
+    void OnProcessInline_(Reactor* reactor, HttpConn* client);
+    void Complete_(Reactor* reactor, HttpConn* client, uint32_t gen, int type);
+    void StartAsync_(Reactor* reactor, HttpConn* client);
+    void PostBlocking_(Reactor* reactor, HttpConn* client);
+    void WatchSql_(Reactor* reactor, int fd, int events, int timeoutMS);
+    void DealSql_(Reactor* reactor, int fd, uint32_t events);
+
+    void DealUringAccept_(Reactor* reactor, uint32_t gen, int res, uint32_t flags);
+    void DealUringRecv_(Reactor* reactor, int fd, uint32_t gen, int res, uint32_t flags);
+    void DealUringSend_(Reactor* reactor, int fd, uint32_t gen, int res);
+    void UringProcess_(Reactor* reactor, HttpConn* client);
+    void UringRecvFlow_(Reactor* reactor, ConnSlab::Slot* slot);
+
+    static uint64_t UringData_(int op, uint32_t gen, int fd);
 
     static const int MAX_FD = 65536;
+    static const uint32_t SQL_TAG = 0xffffffff;         // epoll中数据库连接的tag，连接代数只有24位，不会冲突
+    static const int ACCEPT_BATCH = 64;                 // LT模式下一次可读事件最多accept的连接数，避免饿死其他连接
+    static const int PAUSE_CHECK_MS = 10;               // 暂停accept期间检查负载的间隔
+    static const char BUSY_RESPONSE[];                  // 预先构造好的503响应
 
     static int SetFdNonblock(int fd);
 
     int port_;
     bool openLinger_;
     int timeoutMS_;
-    bool isClose_;
-    int listenFd_;
+    atomic<bool> isClose_;
+    bool reusePort_;
     char* srcDir_;
 
     uint32_t listenEvent_;
     uint32_t connEvent_;
 
-    unique_ptr<HeapTimer> timer_;
+    int dispatchMode_;
+    int ioEngine_;
+    int admitPolicy_;
+    int maxConn_;
+    size_t maxQueue_;
+    atomic<int> admitting_;                             // 已接收、投递给子reactor但尚未注册的连接，计入过载判断
+    bool runInline_;
+    int pinMode_;
+    size_t nextReactor_;                                // 轮询分发的下一个子reactor
+
     unique_ptr<ThreadPool> threadpool_;
-    unique_ptr<Epoller> epoller_;
-    unordered_map<int, HttpConn> users_;
+    unique_ptr<FileUserStore> fileStore_;               // 使用本地文件引擎时非空，不再连接数据库
+    unique_ptr<Reactor> mainReactor_;                   // 负责监听socket，单reactor模式下同时处理连接
+    vector<unique_ptr<Reactor>> subReactors_;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -14,14 +14,13 @@ void HeapTimer::SwapNode_(size_t i, size_t j)
 void HeapTimer::siftup_(size_t i)
 {
     assert(i >= 0 && i < heap_.size());
-    size_t parent = (i-1) / 2;
-    while(parent >= 0)
+    while(i > 0)                // size_t不会小于0，i为0时(i-1)/2会越界，只能以i判断
     {
+        size_t parent = (i-1) / 2;
         if(heap_[parent] > heap_[i])
         {
             SwapNode_(i,parent);
             i = parent;
-            parent = (i-1)/2;
         }
         else
             break;
@@ -45,7 +44,8 @@ bool HeapTimer::siftdown_(size_t i, size_t n)
             index = child;
             child = 2*child + 1;
         }
-        break;   // 跳出循环
+        else
+            break;
     }
     return index > i;
 }
@@ -74,8 +74,10 @@ void HeapTimer::del_(size_t index)
 void HeapTimer::adjust(int id, int newExpires)
 {
     assert(!heap_.empty() && ref_.count(id));
-    heap_[ref_[id]].expires = Clock::now() + MS(newExpires);
-    siftdown_(ref_[id], heap_.size());
+    size_t i = ref_[id];
+    heap_[i].expires = Clock::now() + MS(newExpires);
+    if(!siftdown_(i, heap_.size()))
+        siftup_(i);
 }
 
 void HeapTimer::add(int id, int timeOut, const TimeoutCallBack& cb)
@@ -124,8 +126,8 @@ void HeapTimer::tick()
         if(chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0)
             break;
         
+        pop();              // 先移除再回调，回调里可以重新添加定时器
         node.cb();
-        pop();
     }
 }
 
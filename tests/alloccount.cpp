@@ -0,0 +1,26 @@
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+using namespace std;
+
+// 统计operator new的调用次数，用于检查请求处理路径上的内存分配
+// 单独放在一个编译单元里，替换的operator new/delete不会被内联进调用处，new与free的配对检查不会误报
+atomic<long> newCount(0);
+
+void* operator new(size_t size) {
+    newCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
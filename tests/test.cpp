@@ -1,6 +1,15 @@
 #include "../log/log.h"
 #include "../pool/threadpool.h"
+#include "../server/webserver.h"
+#include "../pool/siphash.h"
+#include <unordered_map>
+#include <poll.h>
+#include <regex>
 #include <features.h>
+#include <sys/un.h>
+
+// operator new的调用次数，见alloccount.cpp
+extern atomic<long> newCount;
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
@@ -45,7 +54,1901 @@ void TestThreadPool() {
     getchar();
 }
 
+// 短连接客户端：connect -> 发一个请求 -> 收到响应 -> RST关闭，统计完成的连接数
+void AcceptRateClient(int port, atomic<bool>* stop, atomic<long>* done) {
+    const char req[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buff[4096];
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct linger optLinger = {1, 0};   // 避免客户端堆积TIME_WAIT耗尽端口
+    while(!*stop) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+            && send(fd, req, sizeof(req) - 1, 0) > 0
+            && recv(fd, buff, sizeof(buff), 0) > 0) {
+            (*done)++;
+        }
+        close(fd);
+    }
+}
+
+double BenchAcceptRate(int port, int subReactorNum, bool reusePort, int clientNum, int seconds) {
+    WebServer server(port, 3, 0, false, 3306, "root", "root", "webserver", 1, 4,
+                     false, 1, 1024, subReactorNum, WebServer::ROUND_ROBIN, reusePort);
+    thread loop([&server]() { server.Start(); });
+
+    atomic<bool> stop(false);
+    atomic<long> done(0);
+    vector<thread> clients;
+    for(int i = 0; i < clientNum; i++) {
+        clients.emplace_back(AcceptRateClient, port, &stop, &done);
+    }
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for(auto& t : clients) {
+        t.join();
+    }
+    server.Stop();
+    loop.join();
+    return (double)done / seconds;
+}
+
+// 单监听socket(主reactor accept后分发) 与 SO_REUSEPORT(每个子reactor各自accept) 的连接建立速率对比
+void TestAcceptRate() {
+    int reactorNum = max(1u, thread::hardware_concurrency());
+    int clientNum = reactorNum * 8;
+    double single = BenchAcceptRate(1316, reactorNum, false, clientNum, 3);
+    double sharded = BenchAcceptRate(1317, reactorNum, true, clientNum, 3);
+    printf("accept rate(%d reactors, %d clients): single listener %.0f conn/s, SO_REUSEPORT %.0f conn/s\n",
+           reactorNum, clientNum, single, sharded);
+}
+
+// 事件分发时按fd找连接的开销：原先的unordered_map(count + operator[]) 与 ConnSlab(下标 + 代数校验)
+void TestDispatchCost() {
+    const int connNum = 50000, eventNum = 10000000, base = 100;
+    vector<int> fds(eventNum);
+    unsigned seed = 1;
+    for(int i = 0; i < eventNum; i++) {
+        seed = seed * 1103515245 + 12345;
+        fds[i] = base + (seed >> 8) % connNum;
+    }
+
+    unordered_map<int, HttpConn> users;
+    for(int i = 0; i < connNum; i++) {
+        users[base + i];
+    }
+    long hit = 0;
+    auto start = chrono::steady_clock::now();
+    for(int fd : fds) {
+        if(users.count(fd) > 0) {
+            hit += !users[fd].IsClose();
+        }
+    }
+    double mapNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / eventNum;
+
+    ConnSlab slab(65536);
+    vector<uint32_t> gens(65536, 0);
+    for(int i = 0; i < connNum; i++) {
+        gens[base + i] = slab.Acquire(base + i)->gen;
+    }
+    start = chrono::steady_clock::now();
+    for(int fd : fds) {
+        ConnSlab::Slot* slot = slab.Get(fd, gens[fd]);
+        if(slot) {
+            hit += !slot->Conn()->IsClose();
+        }
+    }
+    double slabNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / eventNum;
+    printf("dispatch cost(%d conns): unordered_map %.1f ns/event, ConnSlab %.1f ns/event (%ld)\n",
+           connNum, mapNs, slabNs, hit);
+}
+
+// 建立连接并发出一个keep-alive请求，返回fd
+int AdmissionConnect(int port) {
+    const char req[] = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || send(fd, req, sizeof(req) - 1, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 0: 超时无响应 1: 正常响应 2: 503
+int AdmissionReply(int fd, int timeoutMs) {
+    char buff[4096] = {0};
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if(poll(&pfd, 1, timeoutMs) <= 0 || recv(fd, buff, sizeof(buff) - 1, 0) <= 0) {
+        return 0;
+    }
+    return strstr(buff, " 503 ") ? 2 : 1;
+}
+
+// 连接数上限为maxConn，先占满再多建立同样数量的连接：
+// 拒绝策略下多出的连接立即收到503；暂停策略下它们留在backlog中，前面的连接关闭后才被处理
+void TestAdmission() {
+    const int maxConn = 8;
+    const int policies[] = {WebServer::ADMIT_REJECT, WebServer::ADMIT_PAUSE};
+    for(int policy : policies) {
+        int port = 1318 + policy;
+        WebServer server(port, 3, 0, false, 3306, "root", "root", "webserver", 1, 2,
+                         false, 1, 1024, 0, WebServer::ROUND_ROBIN, false, WebServer::ENGINE_EPOLL,
+                         policy, maxConn, 0);
+        thread loop([&server]() { server.Start(); });
+        this_thread::sleep_for(chrono::milliseconds(100));
+
+        vector<int> holders, extras;
+        for(int i = 0; i < maxConn; i++) {
+            holders.push_back(AdmissionConnect(port));
+            AdmissionReply(holders.back(), 1000);
+        }
+        int cnt[2][3] = {{0}};
+        for(int i = 0; i < maxConn; i++) {
+            extras.push_back(AdmissionConnect(port));
+        }
+        for(int fd : extras) {
+            cnt[0][AdmissionReply(fd, 300)]++;
+        }
+        for(int fd : holders) {
+            close(fd);
+        }
+        for(int fd : extras) {
+            if(fd >= 0) {
+                cnt[1][AdmissionReply(fd, 1000)]++;
+                close(fd);
+            }
+        }
+        printf("admission %s: while full served %d, 503 %d, waiting %d; after release served %d\n",
+               policy == WebServer::ADMIT_PAUSE ? "pause" : "reject", cnt[0][1], cnt[0][2], cnt[0][0], cnt[1][1]);
+        assert(policy == WebServer::ADMIT_PAUSE ? (cnt[0][0] == maxConn && cnt[1][1] == maxConn)
+                                                : cnt[0][2] == maxConn);
+        server.Stop();
+        loop.join();
+    }
+
+    // 有子reactor时连接要投递过去才注册，一次涌入的连接在注册前也要计入上限，不能多收一批
+    int port = 1320;
+    WebServer server(port, 3, 0, false, 3306, "root", "root", "webserver", 1, 2,
+                     false, 1, 1024, 2, WebServer::ROUND_ROBIN, false, WebServer::ENGINE_EPOLL,
+                     WebServer::ADMIT_REJECT, maxConn, 0);
+    thread loop([&server]() { server.Start(); });
+    this_thread::sleep_for(chrono::milliseconds(100));
+    vector<int> burst;
+    for(int i = 0; i < maxConn * 4; i++) {
+        burst.push_back(AdmissionConnect(port));
+    }
+    int cnt[3] = {0};
+    for(int fd : burst) {
+        cnt[AdmissionReply(fd, 1000)]++;
+    }
+    for(int fd : burst) {
+        close(fd);
+    }
+    printf("admission burst: served %d, 503 %d\n", cnt[1], cnt[2]);
+    assert(cnt[1] == maxConn && cnt[2] == maxConn * 3);
+    server.Stop();
+    loop.join();
+}
+
+// keep-alive客户端：循环发送同一个GET(body非空时为表单POST)，按Content-length收完整个响应，记录每个请求的延迟(us)
+void LatencyClient(int port, const char* path, atomic<bool>* stop, vector<double>* latency, const char* body = nullptr) {
+    string req = string(body ? "POST " : "GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n";
+    if(body) {
+        req += "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(strlen(body)) + "\r\n\r\n" + body;
+    } else {
+        req += "\r\n";
+    }
+    char buff[65536];
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return;
+    }
+    while(!*stop) {
+        auto start = chrono::steady_clock::now();
+        if(send(fd, req.data(), req.size(), 0) <= 0) {
+            break;
+        }
+        string resp;
+        size_t total = string::npos;
+        while(resp.size() < total) {
+            ssize_t len = recv(fd, buff, sizeof(buff), 0);
+            if(len <= 0) {
+                close(fd);
+                return;
+            }
+            resp.append(buff, len);
+            size_t head = resp.find("\r\n\r\n");
+            size_t pos = resp.find("Content-length: ");
+            if(total == string::npos && head != string::npos && pos != string::npos) {
+                total = head + 4 + atol(resp.c_str() + pos + 16);
+            }
+        }
+        latency->push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    close(fd);
+}
+
+void BenchLatency(int port, bool runInline, int clientNum, int seconds,
+                  int subReactorNum = 0, int pinMode = Affinity::PIN_NONE) {
+    WebServer server(port, 3, 0, false, 3306, "root", "root", "webserver", 1, 4,
+                     false, 1, 1024, subReactorNum, WebServer::ROUND_ROBIN, false, WebServer::ENGINE_EPOLL,
+                     WebServer::ADMIT_REJECT, 0, 0, runInline, pinMode);
+    thread loop([&server]() { server.Start(); });
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    atomic<bool> stop(false);
+    vector<vector<double>> latency(clientNum);
+    vector<thread> clients;
+    for(int i = 0; i < clientNum; i++) {
+        clients.emplace_back(LatencyClient, port, "/index.html", &stop, &latency[i], nullptr);
+    }
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for(auto& t : clients) {
+        t.join();
+    }
+    server.Stop();
+    loop.join();
+
+    vector<double> all;
+    for(auto& v : latency) {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+    sort(all.begin(), all.end());
+    if(all.empty()) {
+        return;
+    }
+    const char* pinName[] = {"", ", pin core", ", pin node"};
+    printf("%s%s: %.0f req/s, p50 %.1f us, p99 %.1f us\n", runInline ? "inline    " : "threadpool", pinName[pinMode],
+           (double)all.size() / seconds, all[all.size() / 2], all[all.size() * 99 / 100]);
+}
+
+// 静态文件keep-alive请求在线程池模式与内联模式下的延迟对比，需在含resources目录的路径下运行
+void TestInlineLatency() {
+    const int clientNums[] = {1, 8};
+    for(int clientNum : clientNums) {
+        printf("%d clients\n", clientNum);
+        BenchLatency(1320, false, clientNum, 3);
+        BenchLatency(1321, true, clientNum, 3);
+    }
+}
+
+// 多reactor下不绑核、绑核、绑NUMA节点的延迟对比，差异主要体现在多路服务器的p99上
+void TestPinLatency() {
+    int reactorNum = max(1u, thread::hardware_concurrency() / 2);
+    printf("%d sub reactors, %d NUMA nodes\n", reactorNum, Affinity::NodeCount());
+    BenchLatency(1322, false, reactorNum * 4, 3, reactorNum, Affinity::PIN_NONE);
+    BenchLatency(1323, false, reactorNum * 4, 3, reactorNum, Affinity::PIN_CORE);
+    BenchLatency(1324, false, reactorNum * 4, 3, reactorNum, Affinity::PIN_NODE);
+}
+
+// 旧的基于std::regex的解析，逐行拷贝成string再匹配，只作为TestParser的对照
+struct LegacyRequest {
+    string method, path, version, body;
+    unordered_map<string, string> header;
+};
+
+void LegacyParse(Buffer& buff, LegacyRequest& req) {
+    static const regex linePatten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+    static const regex headerPatten("^([^:]*): ?(.*)$");
+    const char CRLF[] = "\r\n";
+    int state = 0;
+    smatch subMatch;
+    while(buff.ReadableBytes() && state != 3) {
+        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+        string line(buff.Peek(), lineEnd);
+        if(state == 0) {
+            if(!regex_match(line, subMatch, linePatten)) {
+                return;
+            }
+            req.method = subMatch[1];
+            req.path = subMatch[2];
+            req.version = subMatch[3];
+            state = 1;
+        } else if(state == 1) {
+            if(regex_match(line, subMatch, headerPatten)) {
+                req.header[subMatch[1]] = subMatch[2];
+            } else {
+                state = 2;
+            }
+            if(buff.ReadableBytes() <= 2) {
+                state = 3;
+            }
+        } else {
+            req.body = line;
+            state = 3;
+        }
+        if(lineEnd == buff.BeginWrite()) {
+            break;
+        }
+        buff.RetrieveUntil(lineEnd + 2);
+    }
+}
+
+// 请求行和请求头解析的微基准：旧的regex解析与现在的手写解析，用浏览器的典型请求
+void TestParser() {
+    const char* requests[] = {
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/118.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+        "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: none\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "If-None-Match: \"5f3c-61a2b3c4d5e6f\"\r\n"
+        "\r\n",
+        "GET /images/profile.jpg HTTP/1.1\r\n"
+        "Host: localhost:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/118.0\r\n"
+        "Accept: image/avif,image/webp,*/*\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Referer: http://localhost:1316/picture.html\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "\r\n",
+    };
+    const int loop = 200000;
+    for(const char* request : requests) {
+        size_t len = strlen(request);
+        Buffer buff;
+        HttpRequest req;
+        LegacyRequest legacy;
+        buff.Append(request, len);
+        req.Init();
+        assert(req.parse(buff) == HttpRequest::PARSE_OK && req.IsKeepAlive());
+        buff.RetrieveAll();
+        buff.Append(request, len);
+        LegacyParse(buff, legacy);
+        buff.RetrieveAll();
+        assert(req.method() == legacy.method && req.version() == legacy.version);
+
+        auto begin = chrono::steady_clock::now();
+        for(int i = 0; i < loop; i++) {
+            buff.Append(request, len);
+            legacy = LegacyRequest();
+            LegacyParse(buff, legacy);
+            buff.RetrieveAll();
+        }
+        double legacyNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / loop;
+
+        begin = chrono::steady_clock::now();
+        for(int i = 0; i < loop; i++) {
+            buff.Append(request, len);
+            req.Init();
+            req.parse(buff);
+            buff.RetrieveAll();
+        }
+        double parseNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / loop;
+        printf("%zu bytes: regex %.0f ns/req (%.0f MB/s), parser %.0f ns/req (%.0f MB/s), %.1fx\n",
+               len, legacyNs, len * 1e3 / legacyNs, parseNs, len * 1e3 / parseNs, legacyNs / parseNs);
+    }
+}
+
+// 请求被拆成任意小段到达时解析结果不变，且已解析的字节不会被取走
+void TestIncrementalParse() {
+    const string request =
+        "POST /index HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Connection: keep-alive\r\n"
+        "Content-Length: 7\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "X-Request-Id:  42 \r\n"
+        "\r\n"
+        "a=1&b=2"
+        "GET /next HTTP/1.1\r\n";
+    const size_t firstLen = request.find("GET");
+    for(size_t step = 1; step <= 16; step++) {
+        Buffer buff;
+        HttpRequest req;
+        HttpRequest::PARSE_RESULT ret = HttpRequest::PARSE_AGAIN;
+        size_t fed = 0;
+        while(ret == HttpRequest::PARSE_AGAIN && fed < request.size()) {
+            size_t len = min(step, request.size() - fed);
+            buff.Append(request.data() + fed, len);
+            fed += len;
+            ret = req.parse(buff);
+            assert(ret != HttpRequest::PARSE_ERROR);
+            assert(buff.ReadableBytes() == fed);
+        }
+        assert(ret == HttpRequest::PARSE_OK);
+        assert(fed >= firstLen && fed < firstLen + step);
+        assert(req.Length() == firstLen);
+        assert(req.method() == "POST" && req.path() == "/index.html" && req.IsKeepAlive());
+        assert(req.GetHeader(HttpRequest::HDR_HOST) == "localhost");
+        assert(req.GetHeader("content-LENGTH") == "7" && req.GetHeader("x-request-id") == "42");
+        assert(req.GetHeader(HttpRequest::HDR_RANGE).empty() && req.GetHeader("Cookie").empty());
+        assert(req.body() == "a=1&b=2" && req.GetPost("a") == "1" && req.GetPost("b") == "2");
+        assert(req.GetPost("c").empty());
+        buff.Retrieve(req.Length());
+        buff.Append(request.data() + fed, request.size() - fed);
+        assert(req.parse(buff) == HttpRequest::PARSE_AGAIN);   // 下一个请求还没有空行
+        buff.Append("\r\n", 2);
+        assert(req.parse(buff) == HttpRequest::PARSE_OK && req.path() == "/next");
+    }
+
+    const char* bad[] = {
+        "GET /index.html\r\n\r\n",
+        "get /index.html HTTP/1.1\r\n\r\n",
+        "GET /a b HTTP/1.1\r\n\r\n",
+        "POST /login HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "POST /login HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n",
+        "POST /login HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 50\r\n\r\n",     // 请求走私
+        "POST /login HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n",
+    };
+    for(const char* request : bad) {
+        Buffer buff;
+        HttpRequest req;
+        buff.Append(request, strlen(request));
+        assert(req.parse(buff) == HttpRequest::PARSE_ERROR);
+    }
+    {
+        // 值相同的重复Content-Length按一个处理
+        const char* dup = "POST /index HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\na=1";
+        Buffer buff;
+        HttpRequest req;
+        buff.Append(dup, strlen(dup));
+        assert(req.parse(buff) == HttpRequest::PARSE_OK && req.body() == "a=1");
+    }
+
+    // 只看请求行判断是否要查数据库，不带.html的登录/注册路径也算
+    const char* blocking[] = {"POST /login HTTP/1.1\r\n", "POST /register.html HTTP/1.1\r\n"};
+    const char* nonBlocking[] = {"GET /login HTTP/1.1\r\n", "POST /index HTTP/1.1\r\n", "POST /loginx HTTP/1.1\r\n"};
+    for(const char* line : blocking) {
+        assert(HttpRequest::MayBlock(line, line + strlen(line)));
+    }
+    for(const char* line : nonBlocking) {
+        assert(!HttpRequest::MayBlock(line, line + strlen(line)));
+    }
+    printf("incremental parse ok\n");
+}
+
+// 一次读到的多个流水线请求在一次process()里全部处理，响应通过一次writev发出
+void TestPipeline() {
+    char dir[] = "/tmp/pipelineXXXXXX";
+    assert(mkdtemp(dir));
+    string file = string(dir) + "/index.html";
+    FILE* fp = fopen(file.c_str(), "w");
+    fputs("<html>pipeline</html>\n", fp);
+    fclose(fp);
+    HttpConn::srcDir = dir;
+    HttpConn::isET = false;
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    const int reqNum = 8;
+    string requests;
+    for(int i = 0; i < reqNum; i++) {
+        requests += "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    }
+    requests += "GET /index.html HTTP/1.1\r\nHost: local";        // 不完整的请求留到下一次
+
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    conn.AppendRead(requests.data(), requests.size());
+    assert(conn.process());
+    assert(conn.GetIovCnt() == reqNum * 2);
+    int writeErrno = 0;
+    ssize_t len = conn.write(&writeErrno);
+    assert(len > 0 && conn.ToWriteBytes() == 0);
+
+    char buff[8192];
+    string reply;
+    while(reply.size() < (size_t)len) {
+        ssize_t n = read(fds[1], buff, sizeof(buff));
+        assert(n > 0);
+        reply.append(buff, n);
+    }
+    int responses = 0;
+    for(size_t pos = 0; (pos = reply.find("HTTP/1.1 200 OK", pos)) != string::npos; pos++) {
+        responses++;
+    }
+    assert(responses == reqNum);
+    assert(!conn.process());
+    string rest = "host\r\nConnection: keep-alive\r\n\r\n";
+    conn.AppendRead(rest.data(), rest.size());
+    assert(conn.process() && conn.GetIovCnt() == 2);
+    conn.Close();
+    close(fds[1]);
+    unlink(file.c_str());
+    rmdir(dir);
+    printf("pipeline ok: %d responses, %zd bytes in one writev\n", responses, len);
+}
+
+// 连接预热后，keep-alive请求的解析、生成响应、写出整个过程不再分配内存
+void TestRequestAlloc() {
+    char dir[] = "/tmp/allocXXXXXX";
+    assert(mkdtemp(dir));
+    const char* files[] = {"/index.html", "/picture.html"};
+    for(const char* name : files) {
+        FILE* fp = fopen((string(dir) + name).c_str(), "w");
+        fputs("<html>alloc</html>\n", fp);
+        fclose(fp);
+    }
+    HttpConn::srcDir = dir;
+    HttpConn::isET = false;
+
+    const string requests[] = {
+        "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n",
+        "GET /picture HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml\r\nAccept-Encoding: gzip, deflate, br\r\n\r\n",
+        "POST /index HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 27\r\n\r\n"
+        "username=alice&password=1+2",
+    };
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    char buff[4096];
+    auto round = [&]() {
+        for(const string& request : requests) {
+            conn.AppendRead(request.data(), request.size());
+            assert(conn.process() && conn.IsKeepAlive());
+            int writeErrno = 0;
+            ssize_t len = conn.write(&writeErrno);
+            assert(len > 0 && conn.ToWriteBytes() == 0);
+            for(ssize_t got = 0; got < len; ) {
+                ssize_t n = read(fds[1], buff, sizeof(buff));
+                assert(n > 0);
+                got += n;
+            }
+        }
+    };
+    for(int i = 0; i < 100; i++) {
+        round();
+    }
+    const int loop = 1000;
+    long before = newCount.load();
+    for(int i = 0; i < loop; i++) {
+        round();
+    }
+    long allocs = newCount.load() - before;
+    conn.Close();
+    close(fds[1]);
+    for(const char* name : files) {
+        unlink((string(dir) + name).c_str());
+    }
+    rmdir(dir);
+    printf("%d requests, %ld allocations\n", loop * 3, allocs);
+    assert(allocs == 0);
+
+    // 换块(新申请的块和Reset后复用的块)后的地址同样按align对齐
+    Arena arena(64);
+    for(int pass = 0; pass < 2; pass++) {
+        for(int i = 0; i < 32; i++) {
+            arena.Allocate(i % 7 + 1, 1);
+            size_t align = size_t(1) << (i % 5);
+            void* p = arena.Allocate(i % 3 ? 24 : 100, align);
+            assert(reinterpret_cast<uintptr_t>(p) % align == 0);
+        }
+        arena.Reset();
+    }
+}
+
+// 逐字节的参照实现，只用于和UrlDecoder对拍
+string ReferenceUrlDecode(const string& src) {
+    auto hex = [](char ch) {
+        if(ch >= '0' && ch <= '9') return ch - '0';
+        if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+        if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+        return -1;
+    };
+    string dst;
+    for(size_t i = 0; i < src.size(); i++) {
+        if(src[i] == '+') {
+            dst += ' ';
+        } else if(src[i] == '%' && i + 2 < src.size() && hex(src[i + 1]) >= 0 && hex(src[i + 2]) >= 0) {
+            dst += static_cast<char>(hex(src[i + 1]) * 16 + hex(src[i + 2]));
+            i += 2;
+        } else {
+            dst += src[i];
+        }
+    }
+    return dst;
+}
+
+// URL解码：固定用例、随机输入与参照实现对拍(含原地解码)，以及吞吐
+void TestUrlDecode() {
+    const pair<string, string> cases[] = {
+        {"", ""}, {"abc", "abc"}, {"a+b", "a b"}, {"a%20b", "a b"}, {"100%25+sure", "100% sure"},
+        {"%2b%2B", "++"}, {"%E4%B8%AD%e6%96%87", "\xe4\xb8\xad\xe6\x96\x87"}, {"%zz%4", "%zz%4"},
+        {"%", "%"}, {"%4", "%4"}, {"%%41", "%A"}, {"%00", string(1, '\0')},
+    };
+    char out[256];
+    for(auto& c : cases) {
+        assert(string(out, UrlDecoder::Decode(c.first.data(), c.first.size(), out)) == c.second);
+        assert(string(out, UrlDecoder::DecodeScalar(c.first.data(), c.first.size(), out)) == c.second);
+    }
+
+    // 字母表偏向'%'、'+'和16进制字符，让转义在块边界上的各种位置都出现
+    const char alphabet[] = "%%%%++09afAFgz= &\xff";
+    srand(1);
+    vector<char> buff;
+    for(int round = 0; round < 200000; round++) {
+        size_t len = rand() % 160;
+        string src;
+        for(size_t i = 0; i < len; i++) {
+            src += (rand() % 8 == 0) ? static_cast<char>(rand() % 256) : alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        string expect = ReferenceUrlDecode(src);
+        buff.assign(src.size() + 1, 0);
+        assert(string(buff.data(), UrlDecoder::Decode(src.data(), src.size(), buff.data())) == expect);
+        assert(string(buff.data(), UrlDecoder::DecodeScalar(src.data(), src.size(), buff.data())) == expect);
+        string inplace = src;
+        assert(inplace.substr(0, UrlDecoder::Decode(&inplace[0], inplace.size(), &inplace[0])) == expect);
+    }
+    printf("url decode ok (%s)\n", UrlDecoder::Impl());
+
+    // 纯文本、典型表单(单词间'+'，偶尔有转义)、全是转义(如中文)
+    const size_t size = 1 << 20;
+    string inputs[3];
+    const char* names[] = {"plain", "form", "escaped"};
+    for(size_t i = 0; inputs[0].size() < size; i++) {
+        inputs[0] += 'a' + i % 26;
+    }
+    while(inputs[1].size() < size) {
+        inputs[1] += "username=alice+smith&comment=hello+world%21+this+is+a+test&lang=zh%2Dcn&";
+    }
+    while(inputs[2].size() < size) {
+        inputs[2] += "%E4%B8%AD%E6%96%87";
+    }
+    buff.resize(size * 2);
+    const int loop = 200;
+    for(int k = 0; k < 3; k++) {
+        double mbs[2];
+        for(int simd = 0; simd < 2; simd++) {
+            auto begin = chrono::steady_clock::now();
+            for(int i = 0; i < loop; i++) {
+                if(simd) {
+                    UrlDecoder::Decode(inputs[k].data(), inputs[k].size(), buff.data());
+                } else {
+                    UrlDecoder::DecodeScalar(inputs[k].data(), inputs[k].size(), buff.data());
+                }
+            }
+            double sec = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            mbs[simd] = inputs[k].size() * (double)loop / sec / (1 << 20);
+        }
+        printf("%-8s scalar %6.0f MB/s, %s %6.0f MB/s\n", names[k], mbs[0], UrlDecoder::Impl(), mbs[1]);
+    }
+}
+
+// 路由：方法回退、覆盖、扩容后查找结果不变，查找耗时不随路由数增长；注册的动态路由不用改解析器就能生效
+static string_view EchoPathHandler(const HttpRequest& request) {
+    return request.GetPost("page");
+}
+
+void TestRouter() {
+    Router router;
+    router.AddRewrite("*", "/a", "/a.html");
+    router.AddStatic("GET", "/a");
+    router.AddDynamic("POST", "/a", EchoPathHandler, true);
+    assert(router.Find("GET", "/a")->type == Router::ROUTE_STATIC);
+    assert(router.Find("POST", "/a")->type == Router::ROUTE_DYNAMIC && router.Find("POST", "/a")->mayBlock);
+    assert(router.Find("PUT", "/a")->target == "/a.html");
+    assert(!router.Find("GET", "/b") && !router.Find("GET", ""));
+    router.AddRewrite("*", "/a", "/b.html");
+    assert(router.Find("HEAD", "/a")->target == "/b.html" && router.Size() == 1);
+
+    const int ROUTES = 4096, ROUNDS = 2000000;
+    vector<string> paths;
+    for(int i = 0; i < ROUTES; i++) {
+        paths.push_back("/api/v1/item" + to_string(i));
+        router.AddRewrite("GET", paths.back(), paths.back() + ".html");
+    }
+    for(int i = 0; i < ROUTES; i++) {
+        const Router::Route* route = router.Find("GET", paths[i]);
+        assert(route && route->target == paths[i] + ".html");
+        assert(!router.Find("POST", paths[i]));
+    }
+    for(int count : {8, ROUTES}) {
+        auto start = chrono::steady_clock::now();
+        size_t found = 0;
+        for(int i = 0; i < ROUNDS; i++) {
+            found += router.Find("GET", paths[i % count]) != nullptr;
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ROUNDS;
+        assert(found == (size_t)ROUNDS);
+        printf("%4d routes: %.1f ns/lookup\n", count, ns);
+    }
+
+    Router::Instance()->AddDynamic("POST", "/goto", EchoPathHandler, false, "/index.html");
+    const char* requests[][2] = {
+        {"GET / HTTP/1.1\r\n\r\n", "/index.html"},
+        {"GET /welcome HTTP/1.1\r\n\r\n", "/welcome.html"},
+        {"HEAD /picture HTTP/1.1\r\n\r\n", "/picture.html"},
+        {"GET /unknown.html HTTP/1.1\r\n\r\n", "/unknown.html"},
+        {"POST /login HTTP/1.1\r\n\r\n", "/login.html"},        // 不是表单，不查数据库
+        {"POST /goto HTTP/1.1\r\n\r\n", "/index.html"},
+        {"POST /goto HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+         "Content-Length: 18\r\n\r\npage=%2Fvideo.html", "/video.html"},
+    };
+    for(auto& request : requests) {
+        Buffer buff;
+        HttpRequest req;
+        buff.Append(request[0], strlen(request[0]));
+        assert(req.parse(buff) == HttpRequest::PARSE_OK);
+        assert(req.path() == request[1]);
+    }
+    const char* line = "POST /goto HTTP/1.1\r\n";
+    assert(!HttpRequest::MayBlock(line, line + strlen(line)));
+    printf("router ok\n");
+}
+
+// 请求体：分块格式任意拆分到达结果不变；大请求体转存到临时文件，读缓冲不随请求体增长；
+// Content-Length的大请求体经splice写入文件后交给路由的处理函数
+static size_t uploadLen = 0;
+static uint32_t uploadSum = 0;
+
+static uint32_t BodySum(const char* data, size_t len, uint32_t sum) {
+    for(size_t i = 0; i < len; i++) {
+        sum = sum * 31 + static_cast<uint8_t>(data[i]);
+    }
+    return sum;
+}
+
+static string_view UploadHandler(const HttpRequest& request) {
+    char buff[8192];
+    uploadLen = 0;
+    uploadSum = 0;
+    ssize_t n;
+    while((n = read(request.BodyFd(), buff, sizeof(buff))) > 0) {
+        uploadSum = BodySum(buff, n, uploadSum);
+        uploadLen += n;
+    }
+    return "/index.html";
+}
+
+void TestRequestBody() {
+    const string chunked =
+        "POST /index HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n\r\n"
+        "4\r\na=1&\r\n"
+        "C;ext=1\r\nb=x%0D%0Ay\r\n\r\n"
+        "0\r\nX-Trailer: 1\r\n\r\n"
+        "GET /next HTTP/1.1\r\n\r\n";
+    const size_t firstLen = chunked.find("GET");
+    for(size_t step = 1; step <= 16; step++) {
+        Buffer buff;
+        HttpRequest req;
+        HttpRequest::PARSE_RESULT ret = HttpRequest::PARSE_AGAIN;
+        size_t fed = 0;
+        while(ret == HttpRequest::PARSE_AGAIN && fed < chunked.size()) {
+            size_t len = min(step, chunked.size() - fed);
+            buff.Append(chunked.data() + fed, len);
+            fed += len;
+            ret = req.parse(buff);
+        }
+        assert(ret == HttpRequest::PARSE_OK && fed >= firstLen);
+        assert(req.body() == "a=1&b=x%0D%0Ay\r\n" && req.BodyFd() < 0);
+        assert(req.GetPost("a") == "1" && req.GetPost("b") == "x\r\ny\r\n");
+        buff.Retrieve(req.Length());
+        buff.Append(chunked.data() + fed, chunked.size() - fed);
+        assert(req.parse(buff) == HttpRequest::PARSE_OK && req.path() == "/next");
+    }
+
+    const char* bad[] = {
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nabc\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n123456789\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+    };
+    for(const char* request : bad) {
+        Buffer buff;
+        HttpRequest req;
+        buff.Append(request, strlen(request));
+        assert(req.parse(buff) == HttpRequest::PARSE_ERROR);
+    }
+
+    // 4MB分块上传，每次到达4KB：超过窗口后读缓冲里只剩请求头和不完整的一行
+    string body(4 << 20, 0);
+    for(size_t i = 0; i < body.size(); i++) {
+        body[i] = static_cast<char>(rand());
+    }
+    string large = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    const size_t headerLen = large.size();
+    for(size_t off = 0; off < body.size(); off += 3000) {
+        size_t len = min<size_t>(3000, body.size() - off);
+        char line[16];
+        snprintf(line, sizeof(line), "%zx\r\n", len);
+        large.append(line).append(body, off, len).append("\r\n");
+    }
+    large += "0\r\n\r\n";
+    {
+        Buffer buff;
+        HttpRequest req;
+        HttpRequest::PARSE_RESULT ret = HttpRequest::PARSE_AGAIN;
+        size_t peak = 0;
+        for(size_t fed = 0; ret == HttpRequest::PARSE_AGAIN; fed += 4096) {
+            buff.Append(large.data() + fed, min<size_t>(4096, large.size() - fed));
+            ret = req.parse(buff);
+            peak = max(peak, buff.ReadableBytes());
+        }
+        assert(ret == HttpRequest::PARSE_OK && req.Length() == headerLen);
+        assert(req.body().empty() && req.BodyFd() >= 0 && req.BodyLength() == body.size());
+        string spooled(body.size(), 0);
+        assert(pread(req.BodyFd(), &spooled[0], spooled.size(), 0) == (ssize_t)body.size());
+        assert(spooled == body);
+        printf("chunked %zu bytes, peak buffer %zu bytes\n", body.size(), peak);
+        assert(peak < 64 * 1024 + 8192);
+    }
+
+    // Content-Length上传，经过HttpConn：第一次读到的部分请求体经读缓冲写入，其余的splice
+    char dir[] = "/tmp/uploadXXXXXX";
+    assert(mkdtemp(dir));
+    string file = string(dir) + "/index.html";
+    FILE* fp = fopen(file.c_str(), "w");
+    fputs("<html>upload</html>\n", fp);
+    fclose(fp);
+    HttpConn::srcDir = dir;
+    HttpConn::isET = false;
+    Router::Instance()->AddDynamic("POST", "/upload", UploadHandler, false);
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    string request = "POST /upload HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                     "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+    thread writer([&]() {
+        for(size_t off = 0; off < request.size(); ) {
+            ssize_t n = write(fds[1], request.data() + off, min<size_t>(65536, request.size() - off));
+            assert(n > 0);
+            off += n;
+        }
+    });
+    auto start = chrono::steady_clock::now();
+    bool done = false;
+    while(!done) {
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        poll(&pfd, 1, 1000);
+        int readErrno = 0;
+        ssize_t len = conn.read(&readErrno);
+        assert(len > 0 || readErrno == EAGAIN);
+        done = conn.process();
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    writer.join();
+    assert(uploadLen == body.size() && uploadSum == BodySum(body.data(), body.size(), 0));
+    int writeErrno = 0;
+    assert(conn.write(&writeErrno) > 0 && conn.ToWriteBytes() == 0 && conn.IsKeepAlive());
+    conn.Close();
+    close(fds[1]);
+    unlink(file.c_str());
+    rmdir(dir);
+    printf("upload %zu bytes in %.1f ms (%.0f MB/s)\n", body.size(), ms, body.size() / ms / 1000);
+    printf("request body ok\n");
+}
+
+// 模拟MySQL服务器，只实现登录/注册用到的协议子集：握手不校验密码，user表放在内存里，
+// 每条语句先睡latencyUs模拟慢数据库；监听unix socket，客户端库连接"localhost"时通过MYSQL_UNIX_PORT找到它
+class MockMySql {
+public:
+    MockMySql(const char* path, int latencyUs) : queries(0), prepares(0), executes(0), path_(path), latencyUs_(latencyUs), stop_(false) {
+        struct sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        unlink(path);
+        listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd_, 128) == 0);
+        setenv("MYSQL_UNIX_PORT", path, 1);
+        acceptor_ = thread(&MockMySql::Accept_, this);
+    }
+
+    ~MockMySql() {
+        stop_ = true;
+        acceptor_.join();
+        for(int fd : fds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        for(auto& t : conns_) {
+            t.join();
+        }
+        close(listenFd_);
+        unlink(path_.c_str());
+    }
+
+    void AddUser(const string& name, const string& pwd) {
+        lock_guard<mutex> locker(mtx_);
+        users_[name] = pwd;
+    }
+
+    bool HasUser(const string& name) {
+        lock_guard<mutex> locker(mtx_);
+        return users_.count(name) > 0;
+    }
+
+    // 模拟数据库重启：断开已有的连接
+    void DropConns() {
+        lock_guard<mutex> locker(mtx_);
+        for(int fd : fds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    atomic<long> queries;                   // 执行的语句数，含预编译语句
+    atomic<long> prepares;
+    atomic<long> executes;
+
+private:
+    void Accept_() {
+        while(!stop_) {
+            struct pollfd pfd = {listenFd_, POLLIN, 0};
+            if(poll(&pfd, 1, 50) <= 0) {
+                continue;
+            }
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if(fd >= 0) {
+                lock_guard<mutex> locker(mtx_);
+                fds_.push_back(fd);
+                conns_.emplace_back(&MockMySql::Serve_, this, fd);
+            }
+        }
+    }
+
+    static void PutLenenc(string& out, size_t n) {
+        assert(n < 0xfb);
+        out.push_back(static_cast<char>(n));
+    }
+
+    static void PutStr(string& out, const string& str) {
+        PutLenenc(out, str.size());
+        out += str;
+    }
+
+    static bool Send(int fd, uint8_t seq, const string& payload) {
+        char head[4] = {static_cast<char>(payload.size()), static_cast<char>(payload.size() >> 8),
+                        static_cast<char>(payload.size() >> 16), static_cast<char>(seq)};
+        string packet = string(head, 4) + payload;
+        return send(fd, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t)packet.size();
+    }
+
+    static bool Recv(int fd, string* payload) {
+        unsigned char head[4];
+        if(recv(fd, head, 4, MSG_WAITALL) != 4) {
+            return false;
+        }
+        size_t len = head[0] | (head[1] << 8) | (head[2] << 16);
+        payload->resize(len);
+        return len == 0 || recv(fd, &(*payload)[0], len, MSG_WAITALL) == (ssize_t)len;
+    }
+
+    static string Ok() {
+        return string("\x00\x00\x00\x02\x00\x00\x00", 7);
+    }
+
+    static string Eof() {
+        return string("\xfe\x00\x00\x02\x00", 5);
+    }
+
+    static string Err(int code, const string& msg) {
+        return string("\xff", 1) + static_cast<char>(code & 0xff) + static_cast<char>(code >> 8) + "#23000" + msg;
+    }
+
+    static string ColumnDef(const string& name) {
+        string def;
+        PutStr(def, "def");
+        PutStr(def, "webserver");
+        PutStr(def, "user");
+        PutStr(def, "user");
+        PutStr(def, name);
+        PutStr(def, name);
+        def += string("\x0c\x21\x00\x00\x01\x00\x00\xfd\x00\x00\x00\x00\x00", 13);
+        return def;
+    }
+
+    // 第n个单引号括起来的值，语句由UserVerity生成，值里没有引号
+    static string Quoted(const string& sql, int n) {
+        size_t pos = 0;
+        for(int i = 0; i <= n; i++) {
+            pos = sql.find('\'', pos);
+            if(pos == string::npos) {
+                return string();
+            }
+            pos++;
+            if(i < n) {
+                pos = sql.find('\'', pos) + 1;
+            }
+        }
+        return sql.substr(pos, sql.find('\'', pos) - pos);
+    }
+
+    // 文本协议的值取自语句中的引号，预编译语句的值为params；binary为true时按二进制协议返回结果行
+    void Query_(int fd, const string& sql, const vector<string>& params, bool binary) {
+        queries++;
+        this_thread::sleep_for(chrono::microseconds(latencyUs_));
+        string name = params.empty() ? Quoted(sql, 0) : params[0];
+        if(sql.compare(0, 6, "SELECT") == 0) {
+            // 没有WHERE时返回全部用户
+            vector<pair<string, string>> rows;
+            {
+                lock_guard<mutex> locker(mtx_);
+                if(sql.find(" WHERE ") == string::npos) {
+                    rows.assign(users_.begin(), users_.end());
+                } else if(users_.count(name)) {
+                    rows.emplace_back(name, users_[name]);
+                }
+            }
+            vector<string> fields = Fields(sql);
+            uint8_t seq = 1;
+            string count;
+            PutLenenc(count, fields.size());
+            Send(fd, seq++, count);
+            for(auto& field : fields) {
+                Send(fd, seq++, ColumnDef(field));
+            }
+            Send(fd, seq++, Eof());
+            for(auto& user : rows) {
+                string row;
+                if(binary) {
+                    row.append(1 + (fields.size() + 9) / 8, '\0');
+                }
+                for(auto& field : fields) {
+                    PutStr(row, field == "username" ? user.first : user.second);
+                }
+                Send(fd, seq++, row);
+            }
+            Send(fd, seq++, Eof());
+        } else if(sql.compare(0, 6, "INSERT") == 0) {
+            lock_guard<mutex> locker(mtx_);
+            if(users_.count(name)) {
+                Send(fd, 1, Err(1062, "Duplicate entry"));
+            } else {
+                users_[name] = params.empty() ? Quoted(sql, 1) : params[1];
+                Send(fd, 1, Ok());
+            }
+        } else {
+            Send(fd, 1, Ok());
+        }
+    }
+
+    // SELECT和FROM之间以", "分隔的列名
+    static vector<string> Fields(const string& sql) {
+        vector<string> fields;
+        size_t end = sql.find(" FROM");
+        for(size_t pos = 7; pos < end; ) {
+            size_t next = min(sql.find(", ", pos), end);
+            fields.push_back(sql.substr(pos, next - pos));
+            pos = next + 2;
+        }
+        return fields;
+    }
+
+    static uint32_t Get32(const string& packet, size_t pos) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(packet.data()) + pos;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    // COM_STMT_PREPARE的响应：语句id、列数、参数数，随后是参数和列的定义
+    void Prepare_(int fd, const string& sql, unordered_map<uint32_t, string>* stmts) {
+        uint32_t id = ++prepares;
+        (*stmts)[id] = sql;
+        size_t paramNum = count(sql.begin(), sql.end(), '?');
+        size_t colNum = sql.compare(0, 6, "SELECT") == 0 ? Fields(sql).size() : 0;
+        string ok(1, '\0');
+        ok += string(reinterpret_cast<const char*>(&id), 4);
+        ok += string(1, static_cast<char>(colNum)) + '\0' + static_cast<char>(paramNum) + string(3, '\0');
+        uint8_t seq = 1;
+        Send(fd, seq++, ok);
+        for(size_t i = 0; i < paramNum; i++) {
+            Send(fd, seq++, ColumnDef("?"));
+        }
+        if(paramNum > 0) {
+            Send(fd, seq++, Eof());
+        }
+        for(size_t i = 0; i < colNum; i++) {
+            Send(fd, seq++, ColumnDef("col"));
+        }
+        if(colNum > 0) {
+            Send(fd, seq++, Eof());
+        }
+    }
+
+    // COM_STMT_EXECUTE：id(4) flags(1) iteration(4) null位图 new-params-bound(1) [类型] 值，只支持字符串参数
+    void Execute_(int fd, const string& packet, const unordered_map<uint32_t, string>& stmts) {
+        executes++;
+        auto it = stmts.find(Get32(packet, 1));
+        if(it == stmts.end()) {
+            Send(fd, 1, Err(1243, "Unknown prepared statement handler"));
+            return;
+        }
+        size_t paramNum = count(it->second.begin(), it->second.end(), '?');
+        vector<string> params;
+        size_t pos = 10;
+        if(paramNum > 0) {
+            pos += (paramNum + 7) / 8;
+            pos += packet[pos] == 1 ? 1 + paramNum * 2 : 1;
+            for(size_t i = 0; i < paramNum; i++) {
+                size_t len = static_cast<unsigned char>(packet[pos++]);
+                if(len == 0xfc) {
+                    len = static_cast<unsigned char>(packet[pos]) | (static_cast<unsigned char>(packet[pos + 1]) << 8);
+                    pos += 2;
+                }
+                params.push_back(packet.substr(pos, len));
+                pos += len;
+            }
+        }
+        Query_(fd, it->second, params, true);
+    }
+
+    void Serve_(int fd) {
+        // Handshake V10：协议41、安全连接、插件认证，不支持SSL
+        string hello("\x0a" "5.7.99-mock\0" "\x01\x00\x00\x00" "abcdefgh\0" "\x00\xa2\x21\x02\x00\x08\x00\x15", 33);
+        hello += string(10, '\0') + string("ijklmnopqrst\0", 13) + string("mysql_native_password\0", 22);
+        string packet;
+        if(!Send(fd, 0, hello) || !Recv(fd, &packet) || !Send(fd, 2, Ok())) {
+            return;
+        }
+        unordered_map<uint32_t, string> stmts;
+        while(Recv(fd, &packet) && !packet.empty()) {
+            switch(packet[0]) {
+            case 0x01:                      // COM_QUIT
+                return;
+            case 0x03:                      // COM_QUERY
+                Query_(fd, packet.substr(1), vector<string>(), false);
+                break;
+            case 0x16:                      // COM_STMT_PREPARE
+                Prepare_(fd, packet.substr(1), &stmts);
+                break;
+            case 0x17:                      // COM_STMT_EXECUTE
+                Execute_(fd, packet, stmts);
+                break;
+            case 0x19:                      // COM_STMT_CLOSE，没有响应
+                stmts.erase(Get32(packet, 1));
+                break;
+            default:                        // COM_PING等
+                Send(fd, 1, Ok());
+                break;
+            }
+        }
+    }
+
+    string path_;
+    int latencyUs_;
+    int listenFd_;
+    atomic<bool> stop_;
+    thread acceptor_;
+    vector<int> fds_;
+    vector<thread> conns_;
+    mutex mtx_;
+    unordered_map<string, string> users_;
+};
+
+// 返回响应头里的状态码和Content-length对应的完整响应，连接出错返回空
+string FormRequest(int fd, const char* path, const string& body) {
+    string req = string("POST ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                 "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+    if(send(fd, req.data(), req.size(), 0) != (ssize_t)req.size()) {
+        return string();
+    }
+    string resp;
+    char buff[4096];
+    size_t total = string::npos;
+    while(resp.size() < total) {
+        ssize_t len = recv(fd, buff, sizeof(buff), 0);
+        if(len <= 0) {
+            return string();
+        }
+        resp.append(buff, len);
+        size_t head = resp.find("\r\n\r\n");
+        size_t pos = resp.find("Content-length: ");
+        if(total == string::npos && head != string::npos && pos != string::npos) {
+            total = head + 4 + atol(resp.c_str() + pos + 16);
+        }
+    }
+    return resp;
+}
+
+// 数据库每条语句延迟latencyUs时，线程池查库与reactor异步查库的登录吞吐，以及同时进行的静态文件请求的延迟
+void BenchAsyncLogin(int port, int asyncSqlNum, int latencyUs, int loginClients, int staticClients, int seconds) {
+    MockMySql db("/tmp/tinywebserver_mock.sock", latencyUs);
+    db.AddUser("bench", "bench");
+    WebServer server(port, 3, 0, false, 3306, "root", "root", "webserver", 4, 4,
+                     false, 1, 1024, 2, WebServer::ROUND_ROBIN, false, WebServer::ENGINE_EPOLL,
+                     WebServer::ADMIT_REJECT, 0, 0, false, Affinity::PIN_NONE, asyncSqlNum);
+    thread loop([&server]() { server.Start(); });
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    // 先验证登录和注册的结果
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    string user = "user" + to_string(port);
+    assert(!FormRequest(fd, "/register", "username=" + user + "&password=pwd").empty());
+    assert(db.HasUser(user));
+    assert(!FormRequest(fd, "/register", "username=" + user + "&password=pwd").empty());
+    assert(!FormRequest(fd, "/login", "username=" + user + "&password=pwd").empty());
+    assert(!FormRequest(fd, "/login", "username=" + user + "&password=bad").empty());
+    close(fd);
+
+    atomic<bool> stop(false);
+    vector<vector<double>> latency(loginClients + staticClients);
+    vector<thread> clients;
+    long queries = db.queries;
+    for(int i = 0; i < loginClients + staticClients; i++) {
+        if(i < loginClients) {
+            clients.emplace_back(LatencyClient, port, "/login", &stop, &latency[i], "username=bench&password=bench");
+        } else {
+            clients.emplace_back(LatencyClient, port, "/index.html", &stop, &latency[i], nullptr);
+        }
+    }
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop = true;
+    for(auto& t : clients) {
+        t.join();
+    }
+    server.Stop();
+    loop.join();
+
+    vector<double> login, page;
+    for(int i = 0; i < loginClients + staticClients; i++) {
+        vector<double>& dst = i < loginClients ? login : page;
+        dst.insert(dst.end(), latency[i].begin(), latency[i].end());
+    }
+    sort(login.begin(), login.end());
+    sort(page.begin(), page.end());
+    if(login.empty() || page.empty()) {
+        return;
+    }
+    printf("%s: login %.0f req/s (p50 %.0f us), db %.0f q/s; static %.0f req/s, p50 %.1f us, p99 %.1f us\n",
+           asyncSqlNum > 0 ? "async sql " : "threadpool", (double)login.size() / seconds, login[login.size() / 2],
+           (double)(db.queries - queries) / seconds, (double)page.size() / seconds,
+           page[page.size() / 2], page[page.size() * 99 / 100]);
+}
+
+// 需在含resources目录的路径下运行，客户端库需支持非阻塞接口(MariaDB Connector/C)，否则异步一项会回退到线程池
+void TestAsyncLogin() {
+    const int latencies[] = {1000, 10000};
+    for(int latencyUs : latencies) {
+        printf("db latency %d us\n", latencyUs);
+        BenchAsyncLogin(1325, 0, latencyUs, 32, 4, 3);
+        BenchAsyncLogin(1326, 4, latencyUs, 32, 4, 3);
+    }
+}
+
+// 直接驱动AsyncSqlPool：数据库断开后出错的语句失败，之后非阻塞地重连；语句超时按断开处理
+// 用poll代替reactor，超时不等TIMEOUT_S秒，收到WAIT_TIMEOUT的监听就立即触发
+void TestAsyncReconnect() {
+    if(!AsyncSqlPool::Supported()) {
+        printf("async sql not supported\n");
+        return;
+    }
+    MockMySql db("/tmp/tinywebserver_mock.sock", 0);
+    db.AddUser("alice", "pw");
+    unordered_map<int, int> watched;
+    auto watcher = [&watched](int fd, int events, int) {
+        if(events) {
+            watched[fd] = events;
+        } else {
+            watched.erase(fd);
+        }
+    };
+    unique_ptr<AsyncSqlPool> pool(new AsyncSqlPool(watcher));
+    assert(pool->Init("localhost", 3306, "root", "root", "webserver", 2));
+    bool fireTimeout = false;
+    // 跑到没有要等待的事件为止
+    auto run = [&]() {
+        while(!watched.empty()) {
+            auto it = watched.begin();
+            int fd = it->first, events = it->second;
+            watched.erase(it);
+            if(fireTimeout && (events & AsyncSqlPool::WAIT_TIMEOUT)) {
+                pool->OnEvent(fd, AsyncSqlPool::WAIT_TIMEOUT);
+                continue;
+            }
+            struct pollfd pfd = {fd, static_cast<short>(((events & AsyncSqlPool::WAIT_READ) ? POLLIN : 0) |
+                                                         ((events & AsyncSqlPool::WAIT_WRITE) ? POLLOUT : 0)), 0};
+            assert(poll(&pfd, 1, 1000) == 1);
+            int ready = 0;
+            if(pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                ready |= AsyncSqlPool::WAIT_READ;
+            }
+            if(pfd.revents & POLLOUT) {
+                ready |= AsyncSqlPool::WAIT_WRITE;
+            }
+            pool->OnEvent(fd, ready);
+        }
+    };
+    int done = 0, failed = 0;
+    auto query = [&]() {
+        pool->Query("SELECT username, password FROM user WHERE username='alice' LIMIT 1", [&](MYSQL_RES* res, bool ok) {
+            done++;
+            failed += !ok;
+            assert(!ok || (res && mysql_num_rows(res) == 1));
+        });
+    };
+    query();
+    query();
+    run();
+    assert(done == 2 && failed == 0);
+
+    // 两个连接都断开：每个连接上先发现断开的那条语句失败，之后重连再执行，直到一轮全部成功
+    db.DropConns();
+    for(int round = 0, before = -1; round < 4 && failed != before; round++) {
+        before = failed;
+        query();
+        query();
+        run();
+        assert(pool->Available());
+        run();
+    }
+    assert(failed >= 1 && failed <= 2 && pool->Fds().size() == 2);
+    pool->ClosePool();
+
+    // 语句等待超时：连接按断开处理，同样重连回来；空闲连接上过期的超时事件被忽略
+    MockMySql slow("/tmp/tinywebserver_mock2.sock", 100000);
+    slow.AddUser("alice", "pw");
+    pool.reset(new AsyncSqlPool(watcher));
+    assert(pool->Init("localhost", 3306, "root", "root", "webserver", 1));
+    done = failed = 0;
+    fireTimeout = true;
+    query();
+    run();
+    fireTimeout = false;
+    assert(done == 1 && failed == 1 && pool->Available());
+    run();
+    int fd = pool->Fds()[0];
+    query();
+    run();
+    pool->OnEvent(fd, AsyncSqlPool::WAIT_TIMEOUT);
+    assert(done == 2 && failed == 1);
+    pool->ClosePool();
+    printf("async reconnect ok\n");
+}
+
+// 解析一个登录/注册的POST请求，返回处理函数给出的路径
+string VerifyPath(const char* path, const string& body) {
+    Buffer buff;
+    buff.Append(string("POST ") + path + " HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body);
+    HttpRequest request;
+    assert(request.parse(buff) == HttpRequest::PARSE_OK);
+    return string(request.path());
+}
+
+// threadNum个线程各自循环调用body(线程序号, 本线程第几次)，seconds秒后停止，返回每秒总次数
+// sample不为空时计时期间每200us调用一次，用于采样运行中的状态
+double RunThreads(int threadNum, int seconds, const function<void(int, long)>& body,
+                  const function<void()>& sample = nullptr) {
+    atomic<long> done(0);
+    atomic<bool> stop(false);
+    vector<thread> threads;
+    for(int i = 0; i < threadNum; i++) {
+        threads.emplace_back([&done, &stop, &body, i]() {
+            for(long j = 0; !stop; j++) {
+                body(i, j);
+                done++;
+            }
+        });
+    }
+    if(sample) {
+        auto end = chrono::steady_clock::now() + chrono::seconds(seconds);
+        while(chrono::steady_clock::now() < end) {
+            sample();
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    } else {
+        this_thread::sleep_for(chrono::seconds(seconds));
+    }
+    stop = true;
+    for(auto& t : threads) {
+        t.join();
+    }
+    return (double)done / seconds;
+}
+
+// 登录类测试共用的数据库：MockMySql预置userNum个用户(user<i>，密码同名)，SqlConnPool连到它，
+// 登录缓存和布隆过滤器关闭，需要的测试自己再打开；析构时关闭连接池
+struct MockDbFixture {
+    MockDbFixture(int latencyUs, int connNum, int userNum = 0, int connMax = 0, int waitMS = 1000)
+        : db("/tmp/tinywebserver_mock.sock", latencyUs) {
+        for(int i = 0; i < userNum; i++) {
+            db.AddUser("user" + to_string(i), "user" + to_string(i));
+        }
+        SqlConnPool::Instance()->Init("localhost", 3306, "root", "root", "webserver", connNum, connMax, waitMS);
+        UserCache::Instance()->Init(0);
+        UserFilter::Instance()->Init(0);
+    }
+    ~MockDbFixture() {
+        SqlConnPool::Instance()->ClosePool();
+    }
+    MockMySql db;
+};
+
+// 每个连接上的两条语句只prepare一次，之后都是COM_STMT_EXECUTE；带引号的用户名按参数传递，不会拼进语句
+void TestPreparedStmt() {
+    const int connNum = 2;
+    MockDbFixture fixture(0, connNum);
+    MockMySql& db = fixture.db;
+    db.AddUser("alice", "pw");
+
+    assert(VerifyPath("/login", "username=alice&password=pw") == "/welcome.html");
+    assert(VerifyPath("/login", "username=alice&password=bad") == "/error.html");
+    assert(VerifyPath("/login", "username=bob&password=pw") == "/error.html");
+    assert(VerifyPath("/register", "username=o%27brien&password=x+y") == "/welcome.html");
+    assert(db.HasUser("o'brien"));
+    assert(VerifyPath("/register", "username=o%27brien&password=z") == "/error.html");
+    assert(VerifyPath("/login", "username=o%27brien&password=x+y") == "/welcome.html");
+
+    // 线程数不超过连接数，GetConn不会因为池空返回nullptr
+    double qps = RunThreads(connNum, 1, [](int, long) {
+        VerifyPath("/login", "username=alice&password=pw");
+    });
+    printf("%.0f logins/s, %ld statements: %ld prepares, %ld executes\n",
+           qps, (long)db.queries, (long)db.prepares, (long)db.executes);
+    assert(db.prepares <= connNum * 2 && db.executes == db.queries);
+    printf("prepared stmt ok\n");
+}
+
+// 多个线程轮流登录userNum个用户，返回每秒登录数
+double BenchUserLogin(int threadNum, int userNum, int seconds) {
+    return RunThreads(threadNum, seconds, [userNum](int i, long j) {
+        string name = "user" + to_string((i + j) % userNum);
+        VerifyPath("/login", "username=" + name + "&password=" + name);
+    });
+}
+
+void TestUserCache() {
+    UserCache* cache = UserCache::Instance();
+    // LRU：一直被访问的条目不会被挤掉，总数不超过容量(按分片向上取整)
+    cache->Init(1024);
+    cache->Put("hot", "pwd");
+    for(int i = 0; i < 10000; i++) {
+        cache->Put("user" + to_string(i), "pwd");
+        assert(cache->Find("hot", "pwd") == UserCache::MATCH);
+    }
+    assert(cache->Size() <= 1024 + 16);
+    assert(cache->Find("user9999", "pwd") == UserCache::MATCH);
+    assert(cache->Find("user0", "pwd") == UserCache::ABSENT);
+    assert(cache->Find("hot", "bad") == UserCache::MISMATCH);
+    cache->Put("hot", "new");
+    assert(cache->Find("hot", "new") == UserCache::MATCH);
+    cache->Erase("hot");
+    assert(cache->Find("hot", "new") == UserCache::ABSENT);
+    // TTL
+    cache->Init(1024, 50);
+    cache->Put("alice", "pw");
+    assert(cache->Find("alice", "pw") == UserCache::MATCH);
+    this_thread::sleep_for(chrono::milliseconds(80));
+    assert(cache->Find("alice", "pw") == UserCache::ABSENT);
+    assert(cache->Hits() == 1 && cache->Misses() == 1);
+
+    // 接在UserVerity前面：重复登录不查库，注册写穿，已缓存的用户名注册直接失败
+    const int connNum = 4, userNum = 1000;
+    MockDbFixture fixture(200, connNum, userNum);
+    MockMySql& db = fixture.db;
+    cache->Init(userNum * 2);
+    long queries = db.queries;
+    assert(VerifyPath("/login", "username=user1&password=user1") == "/welcome.html");
+    assert(VerifyPath("/login", "username=user1&password=user1") == "/welcome.html");
+    assert(VerifyPath("/login", "username=user1&password=bad") == "/error.html");
+    assert(db.queries == queries + 2);
+    assert(VerifyPath("/register", "username=carol&password=c") == "/welcome.html");
+    queries = db.queries;
+    assert(VerifyPath("/login", "username=carol&password=c") == "/welcome.html");
+    assert(VerifyPath("/register", "username=carol&password=d") == "/error.html");
+    assert(db.queries == queries);
+
+    for(int size : {0, userNum * 2}) {
+        cache->Init(size);
+        double qps = BenchUserLogin(connNum, userNum, 2);
+        printf("cache %s: %.0f logins/s, hits %llu, misses %llu\n", size ? "on " : "off", qps,
+               (unsigned long long)cache->Hits(), (unsigned long long)cache->Misses());
+    }
+    cache->Init(0);
+    printf("user cache ok\n");
+}
+
+// 撞库式的请求：每次用一个不存在的用户名登录
+double BenchUnknownLogin(int threadNum, int seconds) {
+    return RunThreads(threadNum, seconds, [](int i, long j) {
+        VerifyPath("/login", "username=guess" + to_string(i) + "_" + to_string(j) + "&password=123456");
+    });
+}
+
+void TestUserFilter() {
+    // 没有漏判，误判率在1%左右
+    UserFilter* filter = UserFilter::Instance();
+    const int keyNum = 100000;
+    filter->Init(keyNum);
+    for(int i = 0; i < keyNum; i++) {
+        filter->Add("user" + to_string(i));
+    }
+    int falsePositive = 0;
+    for(int i = 0; i < keyNum; i++) {
+        assert(filter->MayContain("user" + to_string(i)));
+        falsePositive += filter->MayContain("other" + to_string(i));
+    }
+    printf("false positive rate %.2f%%\n", 100.0 * falsePositive / keyNum);
+    assert(falsePositive < keyNum / 50);
+
+    // 并发加入同一个新用户名，只有一个得到"不存在"
+    for(int round = 0; round < 1000; round++) {
+        string name = "race" + to_string(round);
+        atomic<int> claims(0);
+        vector<thread> threads;
+        for(int i = 0; i < 4; i++) {
+            threads.emplace_back([&]() { claims += filter->Add(name); });
+        }
+        for(auto& t : threads) {
+            t.join();
+        }
+        assert(claims <= 1 && !filter->Add(name));
+    }
+
+    const int connNum = 4, userNum = 1000;
+    MockDbFixture fixture(200, connNum, userNum);
+    MockMySql& db = fixture.db;
+    assert(filter->Load(UserStore::Instance()));
+    assert(filter->MayContain("user0") && filter->MayContain("user999"));
+    // 不存在的用户名登录不查库，注册只执行INSERT
+    long queries = db.queries;
+    assert(VerifyPath("/login", "username=nobody&password=x") == "/error.html");
+    assert(db.queries == queries);
+    assert(VerifyPath("/register", "username=dave&password=d") == "/welcome.html");
+    assert(db.queries == queries + 1 && db.HasUser("dave"));
+    assert(VerifyPath("/login", "username=dave&password=d") == "/welcome.html");
+    assert(VerifyPath("/register", "username=dave&password=e") == "/error.html");
+    assert(VerifyPath("/login", "username=user7&password=user7") == "/welcome.html");
+
+    for(int on = 0; on < 2; on++) {
+        if(on) {
+            filter->Load(UserStore::Instance());
+        } else {
+            filter->Init(0);
+        }
+        queries = db.queries;
+        double qps = BenchUnknownLogin(connNum, 2);
+        printf("filter %s: %.0f unknown logins/s, %.0f db queries/s, skipped %llu\n", on ? "on " : "off", qps,
+               (double)(db.queries - queries) / 2, (unsigned long long)filter->Skips());
+    }
+    filter->Init(0);
+    printf("user filter ok\n");
+}
+
+// 同一用户名的并发登录
+double BenchSameLogin(int threadNum, int seconds, int* minFree) {
+    *minFree = SqlConnPool::Instance()->GetFreeConnCount();
+    return RunThreads(threadNum, seconds, [](int, long) {
+        VerifyPath("/login", "username=hot&password=hot");
+    }, [minFree]() {
+        *minFree = min(*minFree, SqlConnPool::Instance()->GetFreeConnCount());
+    });
+}
+
+void TestSingleFlight() {
+    // 同时到达的相同key只执行一次，不同key互不影响，执行完后再来的重新执行
+    SingleFlight<int> group;
+    atomic<int> runs(0);
+    vector<thread> threads;
+    for(int i = 0; i < 8; i++) {
+        threads.emplace_back([&group, &runs, i]() {
+            int val = group.Do(i < 6 ? "a" : "b", [&runs]() {
+                runs++;
+                this_thread::sleep_for(chrono::milliseconds(50));
+                return 42;
+            });
+            assert(val == 42);
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    assert(runs == 2 && group.Shared() == 6 && group.Calls() == 8);
+    bool shared = true;
+    assert(group.Do("a", []() { return 1; }, &shared) == 1 && !shared);
+
+    // 数据库延迟5ms，connNum个线程同时登录同一个用户：合并后每批只查一次，也只占一个连接
+    const int connNum = 8;
+    {
+        MockDbFixture fixture(5000, connNum);
+        MockMySql& db = fixture.db;
+        db.AddUser("hot", "hot");
+        for(int on = 0; on < 2; on++) {
+            HttpRequest::singleFlight = on;
+            long queries = db.queries;
+            int minFree;
+            double qps = BenchSameLogin(connNum, 2, &minFree);
+            printf("single flight %s: %.0f logins/s, %.2f db queries/login, min free conns %d/%d\n", on ? "on " : "off",
+                   qps, (double)(db.queries - queries) / (qps * 2), minFree, connNum);
+            if(on) {
+                assert(minFree >= connNum - 1);
+            }
+        }
+    }
+
+    // reactor的异步连接：同一个reactor上的相同语句合并执行
+    for(int on = 0; on < 2; on++) {
+        HttpRequest::singleFlight = on;
+        printf("async single flight %s\n", on ? "on" : "off");
+        BenchAsyncLogin(1327 + on, 4, 5000, 32, 1, 2);
+    }
+    HttpRequest::singleFlight = true;
+    printf("single flight ok\n");
+}
+
+// 取连接：排队先来先得，超时返回nullptr，排队久了扩容，断线后重连
+void TestConnPool() {
+    MockDbFixture fixture(0, 1, 0, 1, 100);
+    MockMySql& db = fixture.db;
+    db.AddUser("alice", "pw");
+    SqlConnPool* pool = SqlConnPool::Instance();
+    MYSQL* held = pool->GetConn();
+    assert(held);
+    auto start = chrono::steady_clock::now();
+    assert(pool->GetConn(50) == nullptr);
+    assert(chrono::steady_clock::now() - start >= chrono::milliseconds(50));
+    assert(VerifyPath("/login", "username=alice&password=pw") == "/error.html");   // 默认等100ms
+    vector<int> order;
+    mutex orderMtx;
+    vector<thread> threads;
+    for(int i = 0; i < 4; i++) {
+        threads.emplace_back([pool, i, &order, &orderMtx]() {
+            MYSQL* sql = pool->GetConn(1000);
+            assert(sql);
+            {
+                lock_guard<mutex> locker(orderMtx);
+                order.push_back(i);
+            }
+            pool->FreeConn(sql);
+        });
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    pool->FreeConn(held);
+    for(auto& t : threads) {
+        t.join();
+    }
+    assert(order == vector<int>({0, 1, 2, 3}));
+    SqlConnPool::Stats stats = pool->GetStats();
+    assert(stats.timeouts == 2 && stats.waits == 6 && stats.open == 1 && stats.peakBusy == 1 && stats.busy == 0);
+    pool->ClosePool();
+
+    // 2个常驻连接，最多6个：6个线程各占一会儿，排队超过GROW_WAIT_MS的线程新建连接
+    pool->Init("localhost", 3306, "root", "root", "webserver", 2, 6, 1000);
+    threads.clear();
+    for(int i = 0; i < 6; i++) {
+        threads.emplace_back([pool]() {
+            for(int j = 0; j < 5; j++) {
+                MYSQL* sql = pool->GetConn();
+                assert(sql);
+                this_thread::sleep_for(chrono::milliseconds(30));
+                pool->FreeConn(sql);
+            }
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    stats = pool->GetStats();
+    printf("elastic: open %d, grows %llu, waits %llu, max wait %lluus\n", stats.open,
+           (unsigned long long)stats.grows, (unsigned long long)stats.waits, (unsigned long long)stats.maxWaitUs);
+    assert(stats.open > 2 && stats.open <= 6 && stats.grows == (uint64_t)stats.open - 2 && stats.timeouts == 0);
+
+    // 数据库断开所有连接：出错的那次请求失败，之后取连接时ping不通，重连后恢复
+    assert(VerifyPath("/login", "username=alice&password=pw") == "/welcome.html");
+    db.DropConns();
+    VerifyPath("/login", "username=alice&password=pw");
+    assert(VerifyPath("/login", "username=alice&password=pw") == "/welcome.html");
+    assert(pool->GetStats().reconnects == 1);
+    pool->ClosePool();
+
+    // 线程数远多于连接数时，请求排队等待而不是失败
+    const int connNum = 4, threadNum = 32;
+    MockMySql slow("/tmp/tinywebserver_mock2.sock", 2000);
+    slow.AddUser("user0", "user0");
+    pool->Init("localhost", 3306, "root", "root", "webserver", connNum, connNum, 1000);
+    HttpRequest::singleFlight = false;
+    long queries = slow.queries;
+    double qps = BenchUserLogin(threadNum, 1, 2);
+    HttpRequest::singleFlight = true;
+    stats = pool->GetStats();
+    printf("%d threads on %d conns: %.0f logins/s, waits %llu, avg wait %lluus, max wait %lluus, timeouts %llu\n",
+           threadNum, connNum, qps, (unsigned long long)stats.waits,
+           (unsigned long long)(stats.waits ? stats.waitUs / stats.waits : 0),
+           (unsigned long long)stats.maxWaitUs, (unsigned long long)stats.timeouts);
+    assert(stats.timeouts == 0 && slow.queries - queries >= (long)(qps * 2) - threadNum);
+    pool->ClosePool();
+    printf("conn pool ok\n");
+}
+
+// threadNum个线程各自不停地取还连接(可以顺带执行一条查询)，返回每秒次数
+double BenchConnPair(int threadNum, bool bind, bool query, int seconds) {
+    return RunThreads(threadNum, seconds, [bind, query](int i, long j) {
+        if(bind && j == 0) {
+            SqlConnPool::BindThread();
+        }
+        if(query) {
+            string name = "user" + to_string(i);
+            VerifyPath("/login", "username=" + name + "&password=" + name);
+        } else {
+            MYSQL* sql;
+            SqlConnRAII conn(&sql, SqlConnPool::Instance());
+            assert(sql);
+        }
+    });
+}
+
+void TestConnLease() {
+    const int threadNum = 8, connNum = threadNum + 1;
+    MockDbFixture fixture(0, connNum, threadNum, connNum);
+    SqlConnPool* pool = SqlConnPool::Instance();
+
+    // 绑定的线程每次拿到同一个连接；租约最多connNum-1个，线程退出后归还
+    vector<thread> threads;
+    mutex mtx;
+    condition_variable cond;
+    int leased = 0;
+    bool quit = false;
+    for(int i = 0; i < threadNum; i++) {
+        threads.emplace_back([pool, &mtx, &cond, &leased, &quit]() {
+            SqlConnPool::BindThread();
+            MYSQL* first = pool->GetConn();
+            pool->FreeConn(first);
+            for(int j = 0; j < 100; j++) {
+                MYSQL* sql = pool->GetConn();
+                assert(sql == first);
+                pool->FreeConn(sql);
+            }
+            unique_lock<mutex> locker(mtx);
+            leased++;
+            cond.notify_all();
+            cond.wait(locker, [&quit]() { return quit; });
+        });
+    }
+    {
+        unique_lock<mutex> locker(mtx);
+        cond.wait(locker, [&leased]() { return leased == threadNum; });
+    }
+    SqlConnPool::Stats stats = pool->GetStats();
+    assert(stats.leased == threadNum && stats.busy == 0 && pool->GetFreeConnCount() == connNum - threadNum);
+    // 没绑定的线程照常走共享队列
+    MYSQL* shared = pool->GetConn();
+    assert(shared && pool->GetFreeConnCount() == 0);
+    pool->FreeConn(shared);
+    {
+        lock_guard<mutex> locker(mtx);
+        quit = true;
+    }
+    cond.notify_all();
+    for(auto& t : threads) {
+        t.join();
+    }
+    stats = pool->GetStats();
+    assert(stats.leased == 0 && pool->GetFreeConnCount() == connNum);
+
+    for(int query = 0; query < 2; query++) {
+        for(int bind = 0; bind < 2; bind++) {
+            double qps = BenchConnPair(threadNum, bind, query, 1);
+            printf("%s, lease %s: %.0f/s\n", query ? "login" : "get/free conn", bind ? "on " : "off", qps);
+        }
+    }
+    stats = pool->GetStats();
+    assert(stats.leased == 0 && stats.busy == 0 && stats.timeouts == 0);
+    printf("conn lease ok\n");
+}
+
+// 两个引擎的行为一致；本地文件引擎扩容后数据不丢，重新打开后还在；再比较两个引擎的登录吞吐
+void TestUserStore() {
+    // SipHash-2-4的参考值：密钥00..0f，输入00..0e
+    uint8_t msg[15];
+    for(int i = 0; i < 15; i++) {
+        msg[i] = i;
+    }
+    SipHash sip(0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL);
+    sip.Update(msg, 7);
+    sip.Update(msg + 7, 8);
+    assert(sip.Final() == 0xa129ca6149be45e5ULL);
+
+    const char* path = "/tmp/tinywebserver_users.db";
+    const int userNum = 1000, threadNum = 4;
+    unlink(path);
+    {
+        FileUserStore file;
+        assert(file.Open(path, 64));
+        for(int i = 0; i < userNum; i++) {
+            string name = "user" + to_string(i);
+            assert(file.Insert(name, name, false) == UserStore::OK);
+        }
+        assert(file.Insert("user7", "x", false) == UserStore::EXISTS);
+        assert(file.Insert(string(FileUserStore::MAX_LEN + 1, 'a'), "x", false) == UserStore::FAILED);
+        assert(file.Size() == userNum);
+    }
+    {
+        FileUserStore file;
+        assert(file.Open(path));
+        assert(file.Size() == userNum);
+        string pwd;
+        for(int i = 0; i < userNum; i++) {
+            assert(file.Find("user" + to_string(i), &pwd) == UserStore::OK && pwd == "user" + to_string(i));
+        }
+        assert(file.Find("nobody", &pwd) == UserStore::NOT_FOUND);
+        int names = 0;
+        assert(file.ForEach([&names](string_view) { names++; }) && names == userNum);
+    }
+
+    MockDbFixture fixture(0, threadNum, userNum);
+    FileUserStore file;
+    assert(file.Open(path));
+    UserStore* engines[] = {UserStore::Instance(), &file};
+    for(UserStore* engine : engines) {
+        UserStore::Use(engine);
+        string name = string("new_") + engine->Name();
+        assert(VerifyPath("/register", "username=" + name + "&password=pw") == "/welcome.html");
+        assert(VerifyPath("/register", "username=" + name + "&password=pw") == "/error.html");
+        assert(VerifyPath("/login", "username=" + name + "&password=pw") == "/welcome.html");
+        assert(VerifyPath("/login", "username=" + name + "&password=bad") == "/error.html");
+        assert(VerifyPath("/login", "username=user1&password=user1") == "/welcome.html");
+        assert(VerifyPath("/login", "username=nobody&password=x") == "/error.html");
+        UserFilter::Instance()->Load(engine);
+        assert(UserFilter::Instance()->MayContain(name));
+        UserFilter::Instance()->Init(0);
+    }
+    assert(fixture.db.HasUser("new_mysql") && !fixture.db.HasUser("new_file"));
+
+    for(UserStore* engine : engines) {
+        UserStore::Use(engine);
+        double qps = BenchUserLogin(threadNum, userNum, 2);
+        printf("%-5s engine: %.0f logins/s\n", engine->Name(), qps);
+    }
+    UserStore::Use(nullptr);
+    file.Close();
+    unlink(path);
+    printf("user store ok\n");
+}
+
 int main() {
     TestLog();
     // TestThreadPool();
+    // TestAcceptRate();
+    TestDispatchCost();
+    // TestAdmission();
+    // TestInlineLatency();
+    // TestPinLatency();
+    TestParser();
+    TestIncrementalParse();
+    TestPipeline();
+    TestRequestAlloc();
+    TestUrlDecode();
+    TestRouter();
+    TestRequestBody();
+    // TestAsyncLogin();
+    // TestAsyncReconnect();
+    // TestPreparedStmt();
+    // TestUserCache();
+    // TestUserFilter();
+    // TestSingleFlight();
+    // TestConnPool();
+    // TestConnLease();
+    // TestUserStore();
 }